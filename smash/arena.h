@@ -0,0 +1,90 @@
+#ifndef SMASH_ARENA_H_
+#define SMASH_ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (16 << 10)
+
+// Bump allocator for objects that all die together, such as the commands of one line. reset() runs the
+// destructors in reverse order of creation and keeps the blocks, so once the arena has grown to the
+// biggest batch, creating an object no longer calls malloc.
+class Arena {
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    struct Object {
+        void (*destroy)(void *);
+        void *object;
+    };
+
+    std::vector<Block> blocks;
+    // The block being filled and its first free byte
+    size_t blockIndex;
+    size_t offset;
+    std::vector<Object> objects;
+
+    template<typename T>
+    static void destroy(void *object) {
+        static_cast<T *>(object)->~T();
+    }
+
+    void *allocate(size_t size, size_t alignment) {
+        while (blockIndex < blocks.size()) {
+            auto aligned = (offset + alignment - 1) & ~(alignment - 1);
+            if (aligned + size <= blocks[blockIndex].size) {
+                offset = aligned + size;
+                return blocks[blockIndex].data + aligned;
+            }
+            blockIndex++;
+            offset = 0;
+        }
+
+        // operator new aligns for any fundamental type, which covers every object placed at a block start
+        auto blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        blocks.push_back({static_cast<char *>(::operator new(blockSize)), blockSize});
+        offset = size;
+        return blocks.back().data;
+    }
+
+public:
+    Arena() : blocks(), blockIndex(0), offset(0), objects() {}
+
+    ~Arena() {
+        reset();
+        for (auto &block : blocks) {
+            ::operator delete(block.data);
+        }
+    }
+
+    Arena(Arena const &) = delete;
+
+    void operator=(Arena const &) = delete;
+
+    template<typename T, typename... Args>
+    T *create(Args &&... args) {
+        auto object = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        objects.push_back({&Arena::destroy<T>, object});
+        return object;
+    }
+
+    // Destroys every object, pointers handed out by create are dangling afterwards
+    void reset() {
+        for (auto it = objects.rbegin(); it != objects.rend(); ++it) {
+            it->destroy(it->object);
+        }
+        objects.clear();
+        blockIndex = 0;
+        offset = 0;
+    }
+
+    size_t blockCount() const {
+        return blocks.size();
+    }
+};
+
+#endif //SMASH_ARENA_H_
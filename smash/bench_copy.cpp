@@ -0,0 +1,109 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "copy.h"
+
+using namespace std;
+
+struct BenchEngine {
+    CopyMethod method;
+    unsigned uringDepth;
+};
+
+static string tempPath(const string &name) {
+    auto dir = getenv("TMPDIR");
+    return string(dir == nullptr ? "/tmp" : dir) + "/smash_bench_copy_" + to_string(getpid()) + "_" + name;
+}
+
+static bool createSource(const string &path, size_t size) {
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("open");
+        return false;
+    }
+    vector<char> block(COPY_BUFFER_SIZE);
+    for (size_t i = 0; i < block.size(); i++) {
+        block[i] = (char) (i * 2654435761u >> 24);
+    }
+    for (size_t written = 0; written < size; written += block.size()) {
+        if (!writeAll(fd, block.data(), min(block.size(), size - written))) {
+            perror("write");
+            close(fd);
+            return false;
+        }
+    }
+    return close(fd) == 0;
+}
+
+// Copies source to target reps times with the given engine, returns the MB/s or -1
+static double benchEngine(const BenchEngine &engine, const string &source, const string &target, size_t size,
+                          int reps, CopyMethod *usedMethod) {
+    copyEngine = engine.method;
+    copyUringDepth = engine.uringDepth;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++) {
+        auto fdSource = open(source.c_str(), O_RDONLY);
+        auto fdTarget = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fdSource == -1 || fdTarget == -1) {
+            perror("open");
+            return -1;
+        }
+        auto copied = copyFileContent(fdSource, fdTarget, usedMethod);
+        close(fdSource);
+        close(fdTarget);
+        if (copied != (ssize_t) size) {
+            return -1;
+        }
+    }
+    auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (double) size * reps / seconds / (1 << 20);
+}
+
+int main() {
+    const size_t sizes[] = {1 << 20, 16 << 20, 256 << 20};
+    const BenchEngine engines[] = {{COPY_READ_WRITE, 0},
+                                   {COPY_FILE_RANGE, 0},
+                                   {COPY_URING, 8},
+                                   {COPY_URING, 32}};
+    auto source = tempPath("source");
+    auto target = tempPath("target");
+    auto isOk = true;
+
+    cout << left << setw(12) << "size" << setw(24) << "engine" << "MB/s" << endl;
+    for (auto size : sizes) {
+        if (!createSource(source, size)) {
+            return 1;
+        }
+        // Roughly 1 GB per measurement, and never a single copy
+        auto reps = max(2, (int) ((1 << 30) / size));
+
+        for (auto &engine : engines) {
+            CopyMethod usedMethod = COPY_AUTO;
+            auto throughput = benchEngine(engine, source, target, size, reps, &usedMethod);
+
+            string name = copyMethodName(usedMethod);
+            if (usedMethod == COPY_URING) {
+                name += " (depth " + to_string(engine.uringDepth) + ")";
+            } else if (usedMethod != engine.method) {
+                name += " (fallback from " + string(copyMethodName(engine.method)) + ")";
+            }
+
+            cout << left << setw(12) << (to_string(size >> 20) + " MB") << setw(24) << name;
+            if (throughput < 0) {
+                cout << "failed" << endl;
+                isOk = false;
+            } else {
+                cout << fixed << setprecision(1) << throughput << endl;
+            }
+        }
+    }
+
+    unlink(source.c_str());
+    unlink(target.c_str());
+    return isOk ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include "builtins.h"
+
+using namespace std;
+
+#define DISPATCH_ROUNDS (200000)
+
+// The if/else chain createSimpleCommand used to go through, returning the position of the builtin or -1
+static int legacyDispatch(const StringView &cmd) {
+    if (cmd == "pwd") {
+        return 0;
+    } else if (cmd == "cd") {
+        return 1;
+    } else if (cmd == "history") {
+        return 2;
+    } else if (cmd == "jobs") {
+        return 3;
+    } else if (cmd == "showpid") {
+        return 4;
+    } else if (cmd == "kill") {
+        return 5;
+    } else if (cmd == "quit") {
+        return 6;
+    } else if (cmd == "fg") {
+        return 7;
+    } else if (cmd == "bg") {
+        return 8;
+    } else if (cmd == "hash") {
+        return 9;
+    } else if (cmd == "tee") {
+        return 10;
+    } else if (cmd == "set") {
+        return 11;
+    } else if (cmd == "cp") {
+        return 12;
+    }
+    return -1;
+}
+
+static const char *const builtinLines[] = {"pwd", "cd /tmp", "history", "jobs -l", "showpid", "kill -9 1", "quit",
+                                           "fg 1", "bg", "hash -r", "tee -a log", "set launch=auto", "cp a b"};
+
+static const char *const externalLines[] = {"ls -la", "grep -rn TODO .", "git status", "make -j8", "cat file",
+                                            "sleep 1", "echo hello", "vim main.cpp", "ssh host", "python3 run.py",
+                                            "history-tool", "cpp main.c", "setup.sh"};
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Runs dispatch over the first word of every line, returns nanoseconds per line. found counts the builtins.
+template<typename Dispatch>
+static double measure(const vector<StringView> &words, Dispatch dispatch, long *found) {
+    *found = 0;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < DISPATCH_ROUNDS; round++) {
+        for (auto &word : words) {
+            *found += dispatch(word);
+        }
+    }
+    return secondsSince(start) * 1e9 / ((double) DISPATCH_ROUNDS * words.size());
+}
+
+static bool compare(const string &name, const char *const *lines, size_t count) {
+    // Tokenized once, dispatch is all that is measured
+    vector<string> commands;
+    vector<StringView> words;
+    Tokenizer args;
+    for (size_t i = 0; i < count; i++) {
+        args.tokenize(lines[i]);
+        commands.push_back(args[0].str());
+    }
+    for (auto &command : commands) {
+        words.emplace_back(command.c_str(), command.size());
+    }
+
+    long legacyFound, tableFound;
+    auto legacyNs = measure(words, [](const StringView &word) { return legacyDispatch(word) != -1; }, &legacyFound);
+    auto tableNs = measure(words, [](const StringView &word) { return findBuiltin(word) != nullptr; }, &tableFound);
+
+    cout << left << setw(16) << name << fixed << setprecision(2) << "if/else chain " << setw(8) << legacyNs
+         << " ns/line   hash table " << setw(8) << tableNs << " ns/line" << endl;
+    return legacyFound == tableFound;
+}
+
+int main() {
+    auto isSame = compare("builtins", builtinLines, sizeof(builtinLines) / sizeof(builtinLines[0]));
+    isSame = compare("external", externalLines, sizeof(externalLines) / sizeof(externalLines[0])) && isSame;
+    if (!isSame) {
+        cout << "MISMATCH: the table and the chain disagree on what is a builtin" << endl;
+    }
+    return isSame ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "history.h"
+#include "copy.h"
+
+using namespace std;
+
+#define HISTORY_ENTRIES (1000000)
+#define SEARCH_RUNS (200)
+#define WRITERS (8)
+#define WRITER_LINES (20000)
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// A year of typing: a few commands repeat all the time, most lines are seen a handful of times
+static string historyLine(int i) {
+    auto n = i / 8;
+    switch (i % 8) {
+        case 0:
+            return "git commit -m 'fix bug #" + to_string(n % 100000) + "'";
+        case 1:
+            return "cd /home/user/src/project" + to_string(n % 2000);
+        case 2:
+            return "make -j" + to_string(n % 16);
+        case 3:
+            return "vim src/file" + to_string(n % 5000) + ".cpp";
+        case 4:
+            return "grep -rn TODO" + to_string(n % 50000) + " .";
+        case 5:
+            return "ssh host" + to_string(n % 300) + ".example.com";
+        case 6:
+            return "git status";
+        default:
+            return "ls -la";
+    }
+}
+
+static void writeHistory(const string &path) {
+    string data;
+    for (int i = 0; i < HISTORY_ENTRIES; i++) {
+        auto line = historyLine(i);
+        HistoryRecordHeader header = {HISTORY_RECORD_MAGIC, (uint16_t) line.size(), (uint32_t) i};
+        data.append((const char *) &header, sizeof(header));
+        data += line;
+    }
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    writeAll(fd, data.data(), data.size());
+    close(fd);
+}
+
+// Every writer appends its own numbered lines through its own HistoryFile, with compaction when
+// maxEntries is small. Returns false if a writer lost a line that compaction had no reason to drop.
+static bool concurrentAppends(const string &path, size_t maxEntries) {
+    unlink(path.c_str());
+    for (int writer = 0; writer < WRITERS; writer++) {
+        if (fork() == 0) {
+            HistoryFile history;
+            history.open(path, maxEntries);
+            for (int i = 0; i < WRITER_LINES; i++) {
+                history.append("writer " + to_string(writer) + " line " + to_string(i));
+            }
+            _exit(0);
+        }
+    }
+    while (wait(nullptr) > 0) {
+    }
+
+    HistoryFile history;
+    history.open(path, HISTORY_ENTRIES);
+    vector<HistoryMatch> matches;
+    history.search("writer ", &matches);
+
+    // Compaction drops the oldest lines, so each writer must be left with its newest lines without gaps
+    vector<int> first(WRITERS, WRITER_LINES), count(WRITERS, 0);
+    for (auto &match : matches) {
+        int writer, line;
+        if (sscanf(string(match.line, match.size).c_str(), "writer %d line %d", &writer, &line) != 2) {
+            return false;
+        }
+        first[writer] = min(first[writer], line);
+        count[writer]++;
+    }
+
+    auto isComplete = true;
+    for (int writer = 0; writer < WRITERS; writer++) {
+        isComplete = isComplete && count[writer] == WRITER_LINES - first[writer];
+    }
+    if (maxEntries >= WRITERS * WRITER_LINES) {
+        isComplete = isComplete && matches.size() == WRITERS * WRITER_LINES;
+    }
+
+    cout << WRITERS << " writers x " << WRITER_LINES << " lines, histsize " << maxEntries << ": "
+         << matches.size() << " kept, " << (isComplete ? "no line lost" : "LINES LOST") << endl;
+    unlink(path.c_str());
+    return isComplete;
+}
+
+int main() {
+    auto path = "/tmp/smash_bench_history_" + to_string(getpid());
+    writeHistory(path);
+
+    HistoryFile history;
+    auto start = chrono::steady_clock::now();
+    history.open(path, HISTORY_ENTRIES);
+    cout << left << setw(32) << "open (map and count)" << fixed << setprecision(3) << secondsSince(start) * 1e3
+         << " ms, " << history.size() << " entries" << endl;
+
+    vector<HistoryMatch> matches;
+    start = chrono::steady_clock::now();
+    history.search("ls -la", &matches);
+    cout << left << setw(32) << "first search (builds index)" << secondsSince(start) * 1e3 << " ms" << endl;
+
+    const char *patterns[] = {"host42.", "TODO12345 ", "project1999", "fix bug #99999'", "file4321.cpp", "git",
+                              "-j"};
+    for (auto pattern : patterns) {
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < SEARCH_RUNS; i++) {
+            history.search(pattern, &matches);
+        }
+        cout << left << setw(32) << "search '" + string(pattern) + "'" << secondsSince(start) * 1e6 / SEARCH_RUNS
+             << " us, " << matches.size() << " matches" << endl;
+    }
+    unlink(path.c_str());
+
+    auto isComplete = concurrentAppends(path, WRITERS * WRITER_LINES);
+    isComplete = concurrentAppends(path, WRITER_LINES) && isComplete;
+    return isComplete ? 0 : 1;
+}
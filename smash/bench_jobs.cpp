@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include "commands.h"
+
+using namespace std;
+
+// Every operation measured here is O(1) per job, so the ns/op figures should not grow with BENCH_JOBS. Only
+// resuming the stopped job with the highest id walks the stopped ones, which the setStopped pass does once.
+#define BENCH_JOBS (10000)
+
+static double elapsedNs(chrono::steady_clock::time_point start, int ops) {
+    auto elapsed = chrono::steady_clock::now() - start;
+    return (double) chrono::duration_cast<chrono::nanoseconds>(elapsed).count() / ops;
+}
+
+static void report(const string &name, double nsPerOp) {
+    cout << left << setw(24) << name << fixed << setprecision(1) << nsPerOp << " ns/op" << endl;
+}
+
+int main() {
+    JobsList jobs;
+    const string cmdLine = "sleep 100&";
+    // Fake pids far away from real ones, nothing is ever signaled or waited
+    const pid_t basePid = 1 << 22;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_JOBS; i++) {
+        jobs.addJob(cmdLine, basePid + i, 0, i % 10 == 0);
+    }
+    report("addJob", elapsedNs(start, BENCH_JOBS));
+
+    long found = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_JOBS; i++) {
+        found += jobs.getJobById(i + 1) != nullptr;
+    }
+    report("getJobById", elapsedNs(start, BENCH_JOBS));
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_JOBS; i++) {
+        found += jobs.getJobByPid(basePid + i) != nullptr;
+    }
+    report("getJobByPid", elapsedNs(start, BENCH_JOBS));
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_JOBS; i++) {
+        found += jobs.getLastStoppedJob() != nullptr;
+        found += jobs.getLastJobId();
+    }
+    report("getLast*", elapsedNs(start, BENCH_JOBS));
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_JOBS; i++) {
+        auto job = jobs.getJobById(i + 1);
+        jobs.setStopped(job, !job->isStopped);
+    }
+    report("setStopped", elapsedNs(start, BENCH_JOBS));
+
+    ofstream devNull("/dev/null");
+    auto coutBuf = cout.rdbuf(devNull.rdbuf());
+    start = chrono::steady_clock::now();
+    jobs.printJobsList();
+    auto printNs = elapsedNs(start, BENCH_JOBS);
+    cout.rdbuf(coutBuf);
+    report("printJobsList (per job)", printNs);
+
+    start = chrono::steady_clock::now();
+    for (int i = BENCH_JOBS - 1; i >= 0; i--) {
+        jobs.removeJobByPid(basePid + i);
+    }
+    report("removeJobByPid", elapsedNs(start, BENCH_JOBS));
+
+    return found > 0 && jobs.size() == 0 ? 0 : 1;
+}
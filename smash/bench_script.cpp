@@ -0,0 +1,110 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "parser.h"
+
+using namespace std;
+
+#define SCRIPT_LINES (100000)
+#define STARTUP_RUNS (50)
+
+// Builtins only, so the replay measures smash and not process creation. Most lines repeat like the body
+// of a generated loop would, every 16th one is unique.
+static vector<string> scriptLines() {
+    const string repeated[] = {"pwd", "showpid", "cd . && pwd", "jobs", "pwd > /dev/null; showpid"};
+    vector<string> lines;
+    for (int i = 0; i < SCRIPT_LINES; i++) {
+        lines.push_back(i % 16 == 15 ? "cd . # line " + to_string(i) : repeated[i % 5]);
+    }
+    return lines;
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const string &name, double seconds, long lines) {
+    cout << left << setw(28) << name << fixed << setprecision(3) << seconds * 1e6 / lines << " us/line"
+         << endl;
+}
+
+// Runs smash with args, stdin from input (or /dev/null) and stdout to /dev/null, returns the seconds it took
+static double runSmash(const string &smash, const vector<string> &args, const string &input) {
+    vector<char *> argv(1, (char *) smash.c_str());
+    for (auto &arg : args) {
+        argv.push_back((char *) arg.c_str());
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, input.empty() ? "/dev/null" : input.c_str(), O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+
+    auto start = chrono::steady_clock::now();
+    pid_t pid;
+    auto res = posix_spawn(&pid, smash.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (res != 0) {
+        return -1;
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    return secondsSince(start);
+}
+
+int main(int argc, char *argv[]) {
+    auto lines = scriptLines();
+
+    auto start = chrono::steady_clock::now();
+    long errors = 0;
+    for (auto &line : lines) {
+        errors += parseLine(line).list == nullptr;
+    }
+    report("parse every line", secondsSince(start), lines.size());
+
+    ParseCache cache;
+    start = chrono::steady_clock::now();
+    for (auto &line : lines) {
+        errors += cache.parse(line).list == nullptr;
+    }
+    report("parse through the cache", secondsSince(start), lines.size());
+    cout << "cache: " << cache.size() << " distinct lines, " << errors << " syntax errors" << endl;
+
+    // The smash binary is expected next to the benchmark, as both the Makefile and CMake build them
+    auto self = string(argv[0]);
+    auto slash = self.rfind('/');
+    auto smash = (slash == string::npos ? string(".") : self.substr(0, slash)) + "/smash";
+    if (argc > 1) {
+        smash = argv[1];
+    }
+    if (access(smash.c_str(), X_OK) != 0) {
+        cout << "no smash binary at " << smash << ", skipping the replay" << endl;
+        return errors == 0 ? 0 : 1;
+    }
+
+    double startup = 0;
+    for (int i = 0; i < STARTUP_RUNS; i++) {
+        startup += runSmash(smash, {"-c", ""}, "");
+    }
+    cout << left << setw(28) << "startup (smash -c '')" << fixed << setprecision(3)
+         << startup * 1e3 / STARTUP_RUNS << " ms" << endl;
+
+    auto script = "/tmp/smash_bench_script_" + to_string(getpid()) + ".smash";
+    {
+        ofstream out(script);
+        for (auto &line : lines) {
+            out << line << '\n';
+        }
+    }
+    report("replay smash -f", runSmash(smash, {"-f", script}, ""), lines.size());
+    report("replay smash < script", runSmash(smash, {}, script), lines.size());
+    unlink(script.c_str());
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <unistd.h>
+#include "commands.h"
+
+using namespace std;
+
+#define SOAK_COMMANDS (1000000)
+#define SOAK_WARMUP (100000)
+// RSS may move by a few pages as malloc settles, anything leaked per command shows up as hundreds of MB
+#define SOAK_MAX_GROWTH (4 << 20)
+
+static long residentBytes() {
+    long pages = 0, resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Builtins that print nothing, mixed with and-or lists, redirections, unique lines and a few processes in
+// the foreground and in the background, so history, the jobs list and the fg slot all see traffic
+static string soakLine(int i) {
+    if (i % 50000 == 0) {
+        return "true";
+    } else if (i % 50000 == 1) {
+        return "true &";
+    } else if (i % 100 == 0) {
+        return "history > /dev/null";
+    }
+
+    switch (i % 4) {
+        case 0:
+            return "cd .";
+        case 1:
+            return "cd . && cd . || cd .";
+        case 2:
+            return "jobs > /dev/null";
+        default:
+            return "cd . ; set launch=auto # " + to_string(i);
+    }
+}
+
+int main() {
+    SmallShell::getInstance();
+
+    long warmRss = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < SOAK_COMMANDS; i++) {
+        if (i == SOAK_WARMUP) {
+            warmRss = residentBytes();
+        }
+        SmallShell::executeCommand(soakLine(i).c_str());
+    }
+    auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    auto endRss = residentBytes();
+
+    cout << fixed << setprecision(1) << "soak: " << SOAK_COMMANDS << " commands in " << seconds << " secs, rss "
+         << warmRss / 1048576.0 << " MB after " << SOAK_WARMUP << ", " << endRss / 1048576.0 << " MB at the end, "
+         << SmallShell::commandArena->blockCount() << " arena blocks" << endl;
+
+    if (endRss - warmRss > SOAK_MAX_GROWTH) {
+        cout << "soak: rss grew by " << (endRss - warmRss) / 1048576.0 << " MB" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include "utils.h"
+
+using namespace std;
+
+#define BENCH_LINES (1000)
+#define BENCH_ROUNDS (2000)
+#define FUZZ_LINES (200000)
+
+// The old tokenizer: an istringstream split with one malloc per word
+static size_t legacySplit(const string &line, char **args, size_t maxArgs) {
+    size_t i = 0;
+    istringstream iss(_trim(line));
+    for (string s; i < maxArgs - 1 && iss >> s;) {
+        args[i] = (char *) malloc(s.length() + 1);
+        strcpy(args[i], s.c_str());
+        args[++i] = nullptr;
+    }
+    return i;
+}
+
+static string randomLine(mt19937 &random, const string &alphabet, size_t maxLength) {
+    string line(random() % maxLength, ' ');
+    for (auto &c : line) {
+        c = alphabet[random() % alphabet.size()];
+    }
+    return line;
+}
+
+// Checks the invariants every tokenized line must hold, and compares lines without quoting against a
+// plain whitespace split. Returns the number of failed lines.
+static long fuzz() {
+    mt19937 random(1);
+    Tokenizer tokenizer;
+    long failures = 0;
+
+    for (int i = 0; i < FUZZ_LINES; i++) {
+        auto isPlain = i % 2 == 0;
+        auto line = randomLine(random, isPlain ? "ab  \t\r\n" : "ab  \t'\"\\$\n", 64);
+        auto words = tokenizer.tokenize(line);
+
+        auto isOk = words <= line.size() && tokenizer.argv()[words] == nullptr;
+        for (size_t w = 0; isOk && w < words; w++) {
+            isOk = tokenizer.argv()[w] == tokenizer[w].data && strlen(tokenizer[w].data) == tokenizer[w].size;
+        }
+        if (isOk && isPlain) {
+            istringstream iss(line);
+            size_t w = 0;
+            for (string s; isOk && iss >> s; w++) {
+                isOk = tokenizer[w] == s.c_str();
+            }
+            isOk = isOk && w == words;
+        }
+        if (!isOk) {
+            cout << "fuzz: bad split of \"" << line << "\"" << endl;
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static void report(const string &name, long words, chrono::steady_clock::time_point start) {
+    auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << left << setw(24) << name << fixed << setprecision(1) << words / seconds / 1e6 << " M tokens/s" << endl;
+}
+
+int main() {
+    auto failures = fuzz();
+    cout << "fuzz: " << FUZZ_LINES << " lines, " << failures << " failures" << endl;
+
+    mt19937 random(2);
+    vector<string> lines;
+    for (int i = 0; i < BENCH_LINES; i++) {
+        lines.push_back("cp -r -j 4 " + randomLine(random, "abcdefgh/", 40) + " " +
+                        randomLine(random, "abcdefgh/", 40) + " --flag value \"quoted arg\" last");
+    }
+
+    Tokenizer tokenizer;
+    long words = 0;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (auto &line : lines) {
+            words += tokenizer.tokenize(line);
+        }
+    }
+    report("Tokenizer", words, start);
+
+    char *args[64];
+    words = 0;
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (auto &line : lines) {
+            auto count = legacySplit(line, args, 64);
+            for (size_t i = 0; i < count; i++) {
+                free(args[i]);
+            }
+            words += count;
+        }
+    }
+    report("istringstream split", words, start);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,724 @@
+#include <cstring>
+#include "builtins.h"
+
+using namespace std;
+
+// Every builtin has typed Args, a parse filling them from the words of its line, and a create making its
+// command from them. Both return false / nullptr after logging why the line is rejected. Adding a builtin
+// is adding such a struct and a line to builtinTable, nothing else looks at names. Line builtins, which run
+// the rest of their line as typed, parse the whole line instead of its words.
+//
+// Jobs list cleanup (removing finished jobs) should be done
+// before each command that is related to jobs list (jobs,fg,bg,kill,quit kill).
+// https://piazza.com/class/k1yxdx0sx3926r?cid=170
+
+// pwd
+struct GetCurrDirBuiltin {
+    struct Args {
+    };
+
+    static bool parse(const Tokenizer &, Args *) {
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &) {
+        return SmallShell::commandArena->create<GetCurrDirCommand>(cmdLine);
+    }
+};
+
+// cd [dir | -]
+struct ChangeDirBuiltin {
+    struct Args {
+        string path;
+        bool isPrevious;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        if (args.size() > 2) {
+            logError("cd: too many arguments");
+            return false;
+        }
+        parsed->path = args[1].str();
+        parsed->isPrevious = parsed->path == "-";
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        if (parsed.isPrevious && SmallShell::last_pwd.empty()) {
+            logError("cd: OLDPWD not set");
+            return nullptr;
+        }
+        return SmallShell::commandArena->create<ChangeDirCommand>(cmdLine.c_str(), parsed.isPrevious
+                                                                                    ? SmallShell::last_pwd
+                                                                                    : parsed.path);
+    }
+};
+
+// history [-s pattern]
+struct HistoryBuiltin {
+    struct Args {
+        bool isSearch;
+        string pattern;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->isSearch = args.size() == 3 && args[1] == "-s";
+        if (args.size() > 1 && !parsed->isSearch) {
+            logError("history: invalid arguments");
+            return false;
+        }
+        parsed->pattern = args[2].str();
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<HistoryCommand>(cmdLine, SmallShell::history, parsed.isSearch,
+                                                                parsed.pattern);
+    }
+};
+
+// joblog <job-id>
+struct JobLogBuiltin {
+    struct Args {
+        int jobId;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->jobId = toNumber(args[1].str());
+        if (args.size() != 2 || parsed->jobId <= 0) {
+            logError("joblog: invalid arguments");
+            return false;
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<JobLogCommand>(cmdLine, parsed.jobId);
+    }
+};
+
+// jobs [-l | -v | -o job-id]
+struct JobsBuiltin {
+    struct Args {
+        JobsFormat format;
+        bool isLog;
+        JobLogBuiltin::Args log;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->format = args[1] == "-l" ? JOBS_LONG : (args[1] == "-v" ? JOBS_VERBOSE : JOBS_DEFAULT);
+        // jobs -o <id> is joblog <id>
+        parsed->isLog = args[1] == "-o";
+        parsed->log.jobId = toNumber(args[2].str());
+        if (parsed->isLog && (args.size() != 3 || parsed->log.jobId <= 0)) {
+            logError("jobs: invalid arguments");
+            return false;
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        if (parsed.isLog) {
+            return JobLogBuiltin::create(cmdLine, parsed.log);
+        }
+        SmallShell::jobsList->removeFinishedJobs();
+        return SmallShell::commandArena->create<JobsCommand>(cmdLine, SmallShell::jobsList, parsed.format);
+    }
+};
+
+// showpid
+struct ShowPidBuiltin {
+    struct Args {
+    };
+
+    static bool parse(const Tokenizer &, Args *) {
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &) {
+        return SmallShell::commandArena->create<ShowPidCommand>(cmdLine);
+    }
+};
+
+// kill -<signal> <job-id>
+struct KillBuiltin {
+    struct Args {
+        int signal;
+        int jobId;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->signal = parseSignalArg(args[1].str());
+        parsed->jobId = toNumber(args[2].str());
+        if (args.size() > 3 || args[1][0] != '-' || parsed->jobId == -1) {
+            logError("kill: invalid arguments");
+            return false;
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        SmallShell::jobsList->removeFinishedJobs();
+        auto jobEntry = SmallShell::jobsList->getJobById(parsed.jobId);
+        if (jobEntry == nullptr) {
+            logError("kill: job-id " + to_string(parsed.jobId) + " does not exists");
+            return nullptr;
+        }
+
+        return SmallShell::commandArena->create<KillCommand>(cmdLine, parsed.signal, jobEntry->pid);
+    }
+};
+
+// quit [kill]
+struct QuitBuiltin {
+    struct Args {
+        bool isKill;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->isKill = args.size() > 1 && args[1] == "kill";
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        if (parsed.isKill) {
+            SmallShell::jobsList->removeFinishedJobs();
+        }
+        return SmallShell::commandArena->create<QuitCommand>(cmdLine, parsed.isKill, SmallShell::jobsList);
+    }
+};
+
+// A job id argument of fg and bg, isLast when there is none
+struct JobIdArgs {
+    bool isLast;
+    int jobId;
+};
+
+static bool parseJobId(const Tokenizer &args, const string &name, JobIdArgs *parsed) {
+    parsed->isLast = args.size() == 1;
+    parsed->jobId = toNumber(args[1].str());
+    if (!parsed->isLast && (args.size() > 2 || parsed->jobId == -1)) {
+        logError(name + ": invalid arguments");
+        return false;
+    }
+    return true;
+}
+
+// fg [job-id]
+struct ForegroundBuiltin {
+    typedef JobIdArgs Args;
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        return parseJobId(args, "fg", parsed);
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        auto jobsList = SmallShell::jobsList;
+        jobsList->removeFinishedJobs();
+        if (parsed.isLast) {
+            auto lastEntry = jobsList->getLastJob();
+            if (lastEntry == nullptr) {
+                logError("fg: jobs list is empty");
+                return nullptr;
+            }
+            return SmallShell::commandArena->create<ForegroundCommand>(cmdLine, lastEntry);
+        }
+
+        auto jobEntry = jobsList->getJobById(parsed.jobId);
+        if (jobEntry == nullptr) {
+            logError("fg: job-id " + to_string(parsed.jobId) + " does not exists");
+            return nullptr;
+        }
+        return SmallShell::commandArena->create<ForegroundCommand>(cmdLine, jobEntry);
+    }
+};
+
+// bg [job-id]
+struct BackgroundBuiltin {
+    typedef JobIdArgs Args;
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        return parseJobId(args, "bg", parsed);
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        auto jobsList = SmallShell::jobsList;
+        jobsList->removeFinishedJobs();
+        if (parsed.isLast) {
+            auto lastEntry = jobsList->getLastStoppedJob();
+            if (lastEntry == nullptr) {
+                logError("bg: there is no stopped jobs to resume");
+                return nullptr;
+            }
+
+            return SmallShell::commandArena->create<BackgroundCommand>(cmdLine, lastEntry);
+        }
+
+        auto jobEntry = jobsList->getJobById(parsed.jobId);
+        if (jobEntry == nullptr) {
+            logError("bg: job-id " + to_string(parsed.jobId) + " does not exists");
+            return nullptr;
+        } else if (!jobEntry->isStopped) {
+            logError("bg: job-id " + to_string(parsed.jobId) + " is already running in the background");
+            return nullptr;
+        }
+
+        return SmallShell::commandArena->create<BackgroundCommand>(cmdLine, jobEntry);
+    }
+};
+
+// hash [-r]
+struct HashBuiltin {
+    struct Args {
+        bool isReset;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->isReset = args.size() == 2 && args[1] == "-r";
+        if (args.size() > 2 || (args.size() == 2 && !parsed->isReset)) {
+            logError("hash: invalid arguments");
+            return false;
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<HashCommand>(cmdLine, SmallShell::pathCache, parsed.isReset);
+    }
+};
+
+// tee [-a] [file...]
+struct TeeBuiltin {
+    struct Args {
+        bool isAppend;
+        vector<string> files;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->isAppend = false;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "-a") {
+                parsed->isAppend = true;
+            } else if (args[i][0] == '-' && args[i].size > 1) {
+                logError("tee: invalid arguments");
+                return false;
+            } else {
+                parsed->files.push_back(args[i].str());
+            }
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<TeeCommand>(cmdLine, parsed.files, parsed.isAppend);
+    }
+};
+
+// set [option=value]
+struct SetBuiltin {
+    struct Args {
+        string option;
+        string value;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        if (args.size() == 1) {
+            return true;
+        }
+
+        auto option = args[1].str();
+        auto assignIndex = option.find('=');
+        if (args.size() > 2 || assignIndex == string::npos) {
+            logError("set: invalid arguments");
+            return false;
+        }
+        parsed->option = option.substr(0, assignIndex);
+        parsed->value = option.substr(assignIndex + 1);
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<SetCommand>(cmdLine, parsed.option, parsed.value);
+    }
+};
+
+// cp [-r] [-j threads] source target
+struct CopyBuiltin {
+    struct Args {
+        bool isRecursive;
+        int threads;
+        vector<string> paths;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->isRecursive = false;
+        parsed->threads = 0;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "-r" || args[i] == "-R") {
+                parsed->isRecursive = true;
+            } else if (args[i] == "-j" && i + 1 < args.size()) {
+                parsed->threads = toNumber(args[++i].str());
+            } else if (args[i].startsWith("-j")) {
+                parsed->threads = toNumber(args[i].str().substr(2));
+            } else {
+                parsed->paths.push_back(args[i].str());
+            }
+        }
+
+        if (parsed->paths.size() != 2 || parsed->threads < 0) {
+            logError("cp: invalid arguments");
+            return false;
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<CopyCommand>(cmdLine, parsed.paths[0], parsed.paths[1],
+                                                             parsed.isRecursive, parsed.threads);
+    }
+};
+
+// parallel [-j jobs] [-k] command... [::: arg...]
+struct ParallelBuiltin {
+    struct Args {
+        size_t jobs;
+        bool isOrdered;
+        string command;
+        bool hasArgs;
+        vector<string> args;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        // As many runs as CPUs by default
+        auto jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        parsed->isOrdered = false;
+        parsed->hasArgs = false;
+
+        size_t i = 1;
+        for (; i < args.size() && args[i][0] == '-' && args[i].size > 1; i++) {
+            if (args[i] == "-k") {
+                parsed->isOrdered = true;
+            } else if (args[i] == "-j" && i + 1 < args.size()) {
+                jobs = toNumber(args[++i].str());
+            } else if (args[i].startsWith("-j")) {
+                jobs = toNumber(args[i].str().substr(2));
+            } else {
+                jobs = -1;
+                break;
+            }
+        }
+
+        // The command is joined back as GNU parallel does, so "cmd | filter" runs as a line
+        for (; i < args.size() && args[i] != ":::"; i++) {
+            parsed->command += (parsed->command.empty() ? "" : " ") + args[i].str();
+        }
+        parsed->hasArgs = i < args.size();
+        for (i++; i < args.size(); i++) {
+            parsed->args.push_back(args[i].str());
+        }
+
+        if (jobs <= 0 || parsed->command.empty()) {
+            logError("parallel: invalid arguments");
+            return false;
+        }
+        parsed->jobs = (size_t) jobs;
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<ParallelCommand>(cmdLine, parsed.command, parsed.args,
+                                                                 parsed.hasArgs, parsed.jobs, parsed.isOrdered);
+    }
+};
+
+// wait [-n] [-t ms] [job-id...]
+struct WaitBuiltin {
+    struct Args {
+        bool isAny;
+        int timeoutMs;
+        vector<int> jobIds;
+    };
+
+    static bool parse(const Tokenizer &args, Args *parsed) {
+        parsed->isAny = false;
+        parsed->timeoutMs = -1;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "-n") {
+                parsed->isAny = true;
+            } else if (args[i] == "-t" && i + 1 < args.size() && toNumber(args[i + 1].str()) >= 0) {
+                parsed->timeoutMs = toNumber(args[++i].str());
+            } else if (toNumber(args[i].str()) > 0) {
+                parsed->jobIds.push_back(toNumber(args[i].str()));
+            } else {
+                logError("wait: invalid arguments");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static Command *create(const string &cmdLine, const Args &parsed) {
+        return SmallShell::commandArena->create<WaitCommand>(cmdLine, parsed.jobIds, parsed.isAny, parsed.timeoutMs);
+    }
+};
+
+// Where the word at pos ends, line builtins keep the rest of their line as typed, quotes and operators included
+static size_t skipWord(const string &cmdLine, size_t pos) {
+    while (pos < cmdLine.size() && _isWhitespace(cmdLine[pos])) {
+        pos++;
+    }
+    while (pos < cmdLine.size() && !_isWhitespace(cmdLine[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+// time [-o json] <line>
+struct TimeBuiltin {
+    struct Args {
+        bool isJson;
+        string timedLine;
+    };
+
+    static bool parse(const string &cmdLine, Args *parsed) {
+        Tokenizer words;
+        auto count = words.tokenize(cmdLine);
+        auto pos = skipWord(cmdLine, 0);
+        parsed->isJson = count >= 3 && words[1] == "-o" && words[2] == "json";
+        if (parsed->isJson) {
+            pos = skipWord(cmdLine, skipWord(cmdLine, pos));
+        }
+        parsed->timedLine = _trim(cmdLine.substr(min(pos, cmdLine.size())));
+        return true;
+    }
+
+    static Command *create(const string &jobLine, const Args &parsed) {
+        return SmallShell::commandArena->create<TimeCommand>(jobLine, parsed.timedLine, parsed.isJson);
+    }
+};
+
+// limit [-c cpu] [-m memory] [-w io weight] <line>
+struct LimitBuiltin {
+    struct Args {
+        CgroupLimits limits;
+        string limitedLine;
+    };
+
+    static bool parse(const string &cmdLine, Args *parsed) {
+        Tokenizer words;
+        auto count = words.tokenize(cmdLine);
+        auto pos = skipWord(cmdLine, 0);
+        size_t i = 1;
+        auto isValid = true;
+        for (; isValid && i + 1 < count && words[i].size == 2 && words[i][0] == '-'; i += 2) {
+            auto value = words[i + 1].str();
+            auto number = toNumber(value);
+            if (words[i] == "-c") {
+                isValid = parseCpuMax(value, &parsed->limits.cpuMax);
+            } else if (words[i] == "-m") {
+                parsed->limits.memoryMax = value == "max" ? value : to_string(parseSize(value));
+                isValid = value == "max" || parseSize(value) >= 0;
+            } else if (words[i] == "-w" && number > 0 && number <= CGROUP_MAX_IO_WEIGHT) {
+                parsed->limits.ioWeight = number;
+            } else {
+                isValid = false;
+            }
+            pos = skipWord(cmdLine, skipWord(cmdLine, pos));
+        }
+
+        if (!isValid || i >= count) {
+            logError("limit: invalid arguments");
+            return false;
+        }
+        parsed->limitedLine = _trim(cmdLine.substr(min(pos, cmdLine.size())));
+        return true;
+    }
+
+    static Command *create(const string &jobLine, const Args &parsed) {
+        return SmallShell::commandArena->create<LimitCommand>(jobLine, parsed.limits, parsed.limitedLine);
+    }
+};
+
+// pin [-m nodes] [cpus] <line>
+struct PinBuiltin {
+    struct Args {
+        Placement placement;
+        string pinnedLine;
+    };
+
+    static bool parse(const string &cmdLine, Args *parsed) {
+        Tokenizer words;
+        auto count = words.tokenize(cmdLine);
+        auto pos = skipWord(cmdLine, 0);
+        size_t i = 1;
+        vector<int> ids;
+        auto isValid = true;
+        auto &placement = parsed->placement;
+        if (i + 1 < count && words[i] == "-m") {
+            isValid = parseIdList(words[i + 1].str(), &ids) && setPlacementNodes(ids, MPOL_BIND, &placement);
+            pos = skipWord(cmdLine, skipWord(cmdLine, pos));
+            i += 2;
+        }
+        // A CPU list is only digits, commas and dashes, which no command name is
+        if (i < count && strspn(words[i].data, "0123456789,-") == words[i].size) {
+            isValid = isValid && parseIdList(words[i].str(), &ids) && setPlacementCpus(ids, &placement);
+            pos = skipWord(cmdLine, pos);
+            i++;
+        }
+
+        if (!isValid || !(placement.hasCpus || placement.memoryMode != 0) || i >= count) {
+            logError("pin: invalid arguments");
+            return false;
+        }
+        parsed->pinnedLine = _trim(cmdLine.substr(min(pos, cmdLine.size())));
+        return true;
+    }
+
+    static Command *create(const string &jobLine, const Args &parsed) {
+        return SmallShell::commandArena->create<PinCommand>(jobLine, parsed.placement, parsed.pinnedLine);
+    }
+};
+
+template<typename Builtin>
+static Command *createBuiltin(const string &cmdLine, const Tokenizer &args) {
+    typename Builtin::Args parsed;
+    return Builtin::parse(args, &parsed) ? Builtin::create(cmdLine, parsed) : nullptr;
+}
+
+template<typename Builtin>
+static Command *createLineBuiltin(const string &cmdLine, const string &jobLine) {
+    typename Builtin::Args parsed;
+    return Builtin::parse(cmdLine, &parsed) ? Builtin::create(jobLine, parsed) : nullptr;
+}
+
+// A builtin has one of the factories, lineFactory for the line builtins
+struct BuiltinEntry {
+    const char *name;
+    BuiltinFactory factory;
+    LineBuiltinFactory lineFactory;
+};
+
+static constexpr BuiltinEntry builtinTable[] = {
+        {"pwd",      &createBuiltin<GetCurrDirBuiltin>, nullptr},
+        {"cd",       &createBuiltin<ChangeDirBuiltin>,  nullptr},
+        {"history",  &createBuiltin<HistoryBuiltin>,    nullptr},
+        {"jobs",     &createBuiltin<JobsBuiltin>,       nullptr},
+        {"showpid",  &createBuiltin<ShowPidBuiltin>,    nullptr},
+        {"kill",     &createBuiltin<KillBuiltin>,       nullptr},
+        {"quit",     &createBuiltin<QuitBuiltin>,       nullptr},
+        {"fg",       &createBuiltin<ForegroundBuiltin>, nullptr},
+        {"bg",       &createBuiltin<BackgroundBuiltin>, nullptr},
+        {"hash",     &createBuiltin<HashBuiltin>,       nullptr},
+        {"tee",      &createBuiltin<TeeBuiltin>,        nullptr},
+        {"set",      &createBuiltin<SetBuiltin>,        nullptr},
+        {"cp",       &createBuiltin<CopyBuiltin>,       nullptr},
+        {"parallel", &createBuiltin<ParallelBuiltin>,   nullptr},
+        {"joblog",   &createBuiltin<JobLogBuiltin>,     nullptr},
+        {"wait",     &createBuiltin<WaitBuiltin>,       nullptr},
+        {"time",     nullptr,                           &createLineBuiltin<TimeBuiltin>},
+        {"limit",    nullptr,                           &createLineBuiltin<LimitBuiltin>},
+        {"pin",      nullptr,                           &createLineBuiltin<PinBuiltin>},
+};
+
+static constexpr size_t builtinCount = sizeof(builtinTable) / sizeof(builtinTable[0]);
+
+/* The perfect hash: FNV-1a started from a seed, the first seed giving every builtin a slot of its own is
+ * found while compiling, and so is the table from slots to builtins. C++11 constexpr functions are a single
+ * return, so the loops are recursions. */
+
+static constexpr size_t nameLength(const char *name) {
+    return *name == '\0' ? 0 : 1 + nameLength(name + 1);
+}
+
+static constexpr uint32_t hashName(const char *name, size_t size, uint32_t hash) {
+    return size == 0 ? hash : hashName(name + 1, size - 1, (hash ^ (unsigned char) *name) * 16777619u);
+}
+
+static constexpr size_t slotOf(const char *name, size_t size, uint32_t seed) {
+    return hashName(name, size, 2166136261u ^ seed) & (BUILTIN_SLOTS - 1);
+}
+
+static constexpr size_t builtinSlot(size_t i, uint32_t seed) {
+    return slotOf(builtinTable[i].name, nameLength(builtinTable[i].name), seed);
+}
+
+// Whether no two builtins from the pair (i, j) on share a slot
+static constexpr bool isPerfect(uint32_t seed, size_t i, size_t j) {
+    return i >= builtinCount ? true
+                             : (j >= builtinCount ? isPerfect(seed, i + 1, i + 2)
+                                                  : builtinSlot(i, seed) != builtinSlot(j, seed) &&
+                                                    isPerfect(seed, i, j + 1));
+}
+
+static constexpr uint32_t findSeed(uint32_t seed) {
+    return isPerfect(seed, 0, 1) ? seed : findSeed(seed + 1);
+}
+
+static constexpr bool areNamesShort(size_t i) {
+    return i >= builtinCount || (nameLength(builtinTable[i].name) <= BUILTIN_MAX_NAME && areNamesShort(i + 1));
+}
+
+static_assert(builtinCount < BUILTIN_SLOTS / 2, "BUILTIN_SLOTS is too small for the builtins");
+static_assert(areNamesShort(0), "a builtin name is longer than BUILTIN_MAX_NAME");
+
+static constexpr uint32_t builtinSeed = findSeed(0);
+
+// Index + 1 of the builtin in each slot, 0 for an empty slot
+struct SlotTable {
+    uint8_t builtins[BUILTIN_SLOTS];
+};
+
+static constexpr uint8_t builtinAt(size_t slot, size_t i) {
+    return i >= builtinCount ? 0 : (builtinSlot(i, builtinSeed) == slot ? (uint8_t) (i + 1) : builtinAt(slot, i + 1));
+}
+
+template<size_t... Slots>
+struct SlotList {
+};
+
+template<size_t N, size_t... Slots>
+struct MakeSlotList : MakeSlotList<N - 1, N - 1, Slots...> {
+};
+
+template<size_t... Slots>
+struct MakeSlotList<0, Slots...> {
+    typedef SlotList<Slots...> type;
+};
+
+template<size_t... Slots>
+static constexpr SlotTable makeSlotTable(SlotList<Slots...>) {
+    return SlotTable{{builtinAt(Slots, 0)...}};
+}
+
+static constexpr SlotTable slotTable = makeSlotTable(MakeSlotList<BUILTIN_SLOTS>::type());
+
+// Returns nullptr when no builtin is called name
+static const BuiltinEntry *findEntry(const char *name, size_t size) {
+    if (size == 0 || size > BUILTIN_MAX_NAME) {
+        return nullptr;
+    }
+
+    auto index = slotTable.builtins[slotOf(name, size, builtinSeed)];
+    if (index == 0) {
+        return nullptr;
+    }
+
+    // Any other word hashing to the slot differs from its builtin
+    auto &builtin = builtinTable[index - 1];
+    return strncmp(builtin.name, name, size) == 0 && builtin.name[size] == '\0' ? &builtin : nullptr;
+}
+
+BuiltinFactory findBuiltin(const StringView &name) {
+    auto builtin = findEntry(name.data, name.size);
+    return builtin == nullptr ? nullptr : builtin->factory;
+}
+
+LineBuiltinFactory findLineBuiltin(const string &cmdLine) {
+    auto begin = cmdLine.find_first_not_of(WHITESPACE);
+    if (begin == string::npos) {
+        return nullptr;
+    }
+    auto end = min(cmdLine.find_first_of(WHITESPACE, begin), cmdLine.size());
+    auto builtin = findEntry(cmdLine.data() + begin, end - begin);
+    return builtin == nullptr ? nullptr : builtin->lineFactory;
+}
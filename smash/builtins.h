@@ -0,0 +1,25 @@
+#ifndef SMASH_BUILTINS_H_
+#define SMASH_BUILTINS_H_
+
+#include "commands.h"
+
+// Slots of the builtin hash table, a power of 2 comfortably above the number of builtins
+#define BUILTIN_SLOTS (64)
+// Longer words are never hashed, no builtin name is that long
+#define BUILTIN_MAX_NAME (15)
+
+// Parses the words of a builtin and creates its command, returns nullptr after logging why not
+typedef Command *(*BuiltinFactory)(const string &cmdLine, const Tokenizer &args);
+
+// Creates a builtin that runs the rest of its line (time, limit, pin) from the whole line, jobLine is what jobs
+// started by it show. Returns nullptr after logging why not.
+typedef Command *(*LineBuiltinFactory)(const string &cmdLine, const string &jobLine);
+
+// Returns the factory of the builtin called name, nullptr for anything else (an external command)
+BuiltinFactory findBuiltin(const StringView &name);
+
+// Returns the factory of the line builtin that cmdLine starts with, nullptr for any other line. Only looks at
+// the first word, so it costs next to nothing on lines without one.
+LineBuiltinFactory findLineBuiltin(const string &cmdLine);
+
+#endif //SMASH_BUILTINS_H_
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include "cgroup.h"
+#include "copy.h"
+#include "utils.h"
+
+using namespace std;
+
+static const char *const jobControllers[] = {"cpu", "memory", "io"};
+
+static string readCgroupFile(const string &dir, const char *name) {
+    ifstream file(dir + "/" + name);
+    stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+static bool writeCgroupFile(const string &dir, const char *name, const string &value) {
+    auto fd = open((dir + "/" + name).c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    auto isWritten = writeAll(fd, value.data(), value.size());
+    close(fd);
+    return isWritten;
+}
+
+// The value after "name " in a flat keyed file such as cpu.stat, 0 if it is not there
+static long long keyedValue(const string &content, const string &name) {
+    auto at = content.find(name + " ");
+    while (at != string::npos && at != 0 && content[at - 1] != '\n') {
+        at = content.find(name + " ", at + 1);
+    }
+    return at == string::npos ? 0 : strtoll(content.c_str() + at + name.size() + 1, nullptr, 10);
+}
+
+bool parseCpuMax(const string &value, string *cpuMax) {
+    if (value == "max") {
+        *cpuMax = value;
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    auto cpus = strtod(value.c_str(), &end);
+    if (end == value.c_str() || errno != 0 || cpus <= 0) {
+        return false;
+    }
+    if (string(end) == "%") {
+        cpus /= 100;
+    } else if (*end != '\0') {
+        return false;
+    }
+
+    // The kernel takes quotas of 1ms and up
+    auto quota = max((long long) (cpus * CGROUP_CPU_PERIOD), 1000LL);
+    *cpuMax = to_string(quota) + " " + to_string(CGROUP_CPU_PERIOD);
+    return true;
+}
+
+// Smash cannot remove its own cgroup on exit, since it is still in it, so the first limit of the next shell
+// removes what shells that are gone left behind
+static void removeStaleRoots(const string &base) {
+    auto dir = opendir(base.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    for (auto entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+        int pid;
+        if (sscanf(entry->d_name, "smash-%d", &pid) != 1 || pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+
+        auto shellRoot = base + "/" + entry->d_name;
+        auto leaves = opendir(shellRoot.c_str());
+        for (auto leaf = leaves == nullptr ? nullptr : readdir(leaves); leaf != nullptr; leaf = readdir(leaves)) {
+            if (leaf->d_type == DT_DIR && leaf->d_name[0] != '.') {
+                rmdir((shellRoot + "/" + leaf->d_name).c_str());
+            }
+        }
+        if (leaves != nullptr) {
+            closedir(leaves);
+        }
+        rmdir(shellRoot.c_str());
+    }
+    closedir(dir);
+}
+
+bool JobCgroups::setup() {
+    // The cgroup2 mount is /sys/fs/cgroup on a unified system and /sys/fs/cgroup/unified on a hybrid one
+    string mountPoint;
+    ifstream mountInfo("/proc/self/mountinfo");
+    for (string line; mountPoint.empty() && getline(mountInfo, line);) {
+        istringstream fields(line);
+        string field, point;
+        for (int i = 0; i < 5 && fields >> field; i++) {
+            point = field;
+        }
+        while (fields >> field && field != "-") {
+        }
+        if (fields >> field && field == "cgroup2") {
+            mountPoint = point;
+        }
+    }
+
+    string ownPath;
+    ifstream cgroupFile("/proc/self/cgroup");
+    for (string line; getline(cgroupFile, line);) {
+        if (line.compare(0, 3, "0::") == 0) {
+            ownPath = line.substr(3);
+        }
+    }
+
+    if (mountPoint.empty() || ownPath.empty()) {
+        logError("limit: cgroup v2 is not available");
+        return false;
+    }
+
+    base = mountPoint + (ownPath == "/" ? "" : ownPath);
+    removeStaleRoots(base);
+    auto shellRoot = base + "/smash-" + to_string(getpid());
+    if ((mkdir(shellRoot.c_str(), 0755) == -1 && errno != EEXIST) ||
+        (mkdir((shellRoot + "/shell").c_str(), 0755) == -1 && errno != EEXIST)) {
+        logSysCallError("mkdir");
+        return false;
+    }
+    if (!writeCgroupFile(shellRoot + "/shell", "cgroup.procs", "0")) {
+        logSysCallError("write");
+        return false;
+    }
+    root = shellRoot;
+
+    // Enabling fails for the base when something else still runs there, which leaves the jobs without it
+    controllers.clear();
+    istringstream available(readCgroupFile(base, "cgroup.controllers"));
+    for (string controller; available >> controller;) {
+        if (find(begin(jobControllers), end(jobControllers), controller) == end(jobControllers)) {
+            continue;
+        }
+        writeCgroupFile(base, "cgroup.subtree_control", "+" + controller);
+        if (writeCgroupFile(root, "cgroup.subtree_control", "+" + controller)) {
+            controllers.push_back(controller);
+        }
+    }
+    return true;
+}
+
+bool JobCgroups::isEnabled(const string &controller) const {
+    return find(controllers.begin(), controllers.end(), controller) != controllers.end();
+}
+
+int JobCgroups::createLeaf(const CgroupLimits &limits, string *path) {
+    if (root.empty() && !setup()) {
+        return -1;
+    }
+
+    auto pending = std::move(pendingLeaves);
+    pendingLeaves.clear();
+    for (auto &leaf : pending) {
+        removeLeaf(leaf);
+    }
+
+    const char *missing = nullptr;
+    if (!limits.cpuMax.empty() && !isEnabled("cpu")) {
+        missing = "cpu";
+    } else if (!limits.memoryMax.empty() && !isEnabled("memory")) {
+        missing = "memory";
+    } else if (limits.ioWeight > 0 && !isEnabled("io")) {
+        missing = "io";
+    }
+    if (missing != nullptr) {
+        logError(string("limit: the ") + missing + " controller is not delegated to " + base);
+        return -1;
+    }
+
+    *path = root + "/job-" + to_string(nextLeaf++);
+    if (mkdir(path->c_str(), 0755) == -1) {
+        logSysCallError("mkdir");
+        return -1;
+    }
+
+    if ((!limits.cpuMax.empty() && !writeCgroupFile(*path, "cpu.max", limits.cpuMax)) ||
+        (!limits.memoryMax.empty() && !writeCgroupFile(*path, "memory.max", limits.memoryMax)) ||
+        (limits.ioWeight > 0 && !writeCgroupFile(*path, "io.weight", "default " + to_string(limits.ioWeight)))) {
+        logSysCallError("write");
+        rmdir(path->c_str());
+        return -1;
+    }
+
+    auto fd = open(path->c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        logSysCallError("open");
+        rmdir(path->c_str());
+    }
+    return fd;
+}
+
+void JobCgroups::removeLeaf(const string &path) {
+    // A killed job is dropped right away, its processes may take a moment to leave the cgroup
+    if (rmdir(path.c_str()) == -1 && errno == EBUSY) {
+        pendingLeaves.push_back(path);
+    }
+}
+
+pid_t forkIntoCgroup(int cgroupFd, const string &path) {
+    pid_t pid;
+#if defined(CLONE_INTO_CGROUP) && defined(SYS_clone3)
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = (uint64_t) cgroupFd;
+
+    pid = (pid_t) syscall(SYS_clone3, &args, sizeof(args));
+    if (pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)) {
+        if (pid == -1) {
+            logSysCallError("clone3");
+        }
+        return pid;
+    }
+#else
+    (void) cgroupFd;
+#endif
+
+    pid = fork();
+    if (pid == 0 && !writeCgroupFile(path, "cgroup.procs", "0")) {
+        logSysCallError("write");
+        _exit(1);
+    } else if (pid == -1) {
+        logSysCallError("fork");
+    }
+    return pid;
+}
+
+bool readCgroupUsage(const string &path, CgroupUsage *usage) {
+    auto cpuStat = readCgroupFile(path, "cpu.stat");
+    if (cpuStat.empty()) {
+        return false;
+    }
+    usage->usageUsec = keyedValue(cpuStat, "usage_usec");
+    usage->throttledUsec = keyedValue(cpuStat, "throttled_usec");
+
+    auto memoryCurrent = readCgroupFile(path, "memory.current");
+    usage->hasMemory = !memoryCurrent.empty();
+    if (usage->hasMemory) {
+        usage->memoryCurrent = strtoll(memoryCurrent.c_str(), nullptr, 10);
+        // memory.peak came with Linux 5.19
+        usage->memoryPeak = strtoll(readCgroupFile(path, "memory.peak").c_str(), nullptr, 10);
+        usage->oomKills = keyedValue(readCgroupFile(path, "memory.events"), "oom_kill");
+    }
+
+    // One line per device: "8:0 rbytes=... wbytes=... rios=..."
+    usage->hasIo = access((path + "/io.stat").c_str(), F_OK) == 0;
+    istringstream ioStat(readCgroupFile(path, "io.stat"));
+    for (string field; ioStat >> field;) {
+        if (field.compare(0, 7, "rbytes=") == 0) {
+            usage->ioReadBytes += strtoll(field.c_str() + 7, nullptr, 10);
+        } else if (field.compare(0, 7, "wbytes=") == 0) {
+            usage->ioWriteBytes += strtoll(field.c_str() + 7, nullptr, 10);
+        }
+    }
+    return true;
+}
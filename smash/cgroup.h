@@ -0,0 +1,83 @@
+#ifndef SMASH_CGROUP_H_
+#define SMASH_CGROUP_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#define CGROUP_CPU_PERIOD (100000)
+#define CGROUP_MAX_IO_WEIGHT (10000)
+
+// What the limit builtin asks for, empty or 0 leaves the kernel default
+struct CgroupLimits {
+    // "<quota> <period>" or "max", as cpu.max takes it
+    std::string cpuMax;
+    // Bytes or "max"
+    std::string memoryMax;
+    int ioWeight;
+
+    CgroupLimits() : cpuMax(), memoryMax(), ioWeight(0) {}
+};
+
+// Read from a job's cgroup, the has fields are false when the controller is not enabled there
+struct CgroupUsage {
+    int64_t usageUsec;
+    int64_t throttledUsec;
+    bool hasMemory;
+    long long memoryCurrent;
+    long long memoryPeak;
+    long long oomKills;
+    bool hasIo;
+    long long ioReadBytes;
+    long long ioWriteBytes;
+
+    CgroupUsage() : usageUsec(0), throttledUsec(0), hasMemory(false), memoryCurrent(0), memoryPeak(0), oomKills(0),
+                    hasIo(false), ioReadBytes(0), ioWriteBytes(0) {}
+};
+
+// Parses "50%" (of one CPU), "1.5" (CPUs) or "max" into a cpu.max value, returns false if invalid
+bool parseCpuMax(const std::string &value, std::string *cpuMax);
+
+// Gives every limited job a cgroup v2 leaf of its own, under the cgroup smash was started in, which must be
+// delegated to the user (systemd-run --user --scope -p Delegate=yes, or any cgroup the user owns):
+//
+//   <smash's cgroup>/smash-<pid>/shell    smash itself, moved there on first use
+//   <smash's cgroup>/smash-<pid>/job-<n>  one per limited job
+//
+// Smash has to leave its cgroup because controllers can only be enabled for the children of a cgroup holding
+// no processes. Controllers that the delegated cgroup does not offer are left out: jobs are still placed and
+// accounted (cpu.stat is always there), but limits needing them are refused.
+class JobCgroups {
+    std::string base;
+    std::string root;
+    std::vector<std::string> controllers;
+    int nextLeaf;
+    // Leaves of jobs whose processes had not all exited when the job was dropped, removed later
+    std::vector<std::string> pendingLeaves;
+
+    bool setup();
+
+    bool isEnabled(const std::string &controller) const;
+
+public:
+    JobCgroups() : base(), root(), controllers(), nextLeaf(1), pendingLeaves() {}
+
+    JobCgroups(JobCgroups const &) = delete;
+
+    void operator=(JobCgroups const &) = delete;
+
+    // Creates a leaf with the limits applied and returns a descriptor of its directory for CLONE_INTO_CGROUP,
+    // or -1 after logging why
+    int createLeaf(const CgroupLimits &limits, std::string *path);
+
+    void removeLeaf(const std::string &path);
+};
+
+// Forks a child that starts in the cgroup, with clone3 and CLONE_INTO_CGROUP where the kernel has it (5.7),
+// otherwise the child moves itself before returning. Returns like fork, logging a failure.
+pid_t forkIntoCgroup(int cgroupFd, const std::string &path);
+
+bool readCgroupUsage(const std::string &path, CgroupUsage *usage);
+
+#endif //SMASH_CGROUP_H_
@@ -5,272 +5,299 @@
 #include <sys/wait.h>
 #include <ctime>
 #include <fcntl.h>
+#include <poll.h>
+#include <deque>
+#include <sys/signalfd.h>
 #include "commands.h"
+#include "signals.h"
+#include "copy.h"
+#include "builtins.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <spawn.h>
+#include <climits>
 
 using namespace std;
 
 string SmallShell::last_pwd;
 CommandsHistory *SmallShell::history;
+HistoryFile *SmallShell::historyFile;
+size_t SmallShell::historySize;
 JobsList *SmallShell::jobsList;
-JobEntry *SmallShell::fgProcess;
-
-void setFg(Command *cmd, pid_t pid) {
-    delete SmallShell::fgProcess;
-    SmallShell::fgProcess = new JobEntry(pid, cmd, -1, getCurrentTime());
+PathCache *SmallShell::pathCache;
+unique_ptr<JobEntry> SmallShell::fgProcess;
+Arena *SmallShell::commandArena;
+LaunchMode SmallShell::launchMode;
+size_t SmallShell::pipeSize;
+bool SmallShell::isSubshell;
+ParseCache *SmallShell::parseCache;
+int SmallShell::lastStatus;
+TimePhases *SmallShell::timePhases;
+JobCgroups *SmallShell::cgroups;
+JobPlacer *SmallShell::placer;
+bool SmallShell::isPinned;
+JobOutputs *SmallShell::jobOutputs;
+
+JobEntry *setFg(Command *cmd, pid_t pid) {
+    SmallShell::fgProcess.reset(new JobEntry(pid, cmd->cmdLine, -1, getMonotonicTime()));
+    return SmallShell::fgProcess.get();
 }
 
-bool isFgCmd(Command *cmd) {
-    return dynamic_cast<const ForegroundCommand *>(cmd) != nullptr;
+// Applies the set pin=... placement of the next background job, unless the line is run by pin
+static bool placeBackgroundJob(PlacementScope *scope) {
+    Placement placement;
+    return SmallShell::isPinned || !SmallShell::placer->nextPlacement(&placement) || scope->apply(placement);
 }
 
-void SmallShell::executeCommand(const char *cmdBuffer) {
-    auto cmdCopy = string(cmdBuffer);
-
-    bool isBgCmd = isBackgroundCommand(cmdCopy.c_str());
-
-    removeBackgroundSign((char *) cmdCopy.c_str());
-
-    auto tweakedCmdLine = string(cmdCopy);
-
-    auto cmd = createCommand(tweakedCmdLine);
-
-    if (cmd == nullptr) {
+// External commands and pipelines are spawned straight into the job, anything else needs a forked smash.
+// The job shows jobCmdLine, which may differ from what runs (the trailing &).
+static void runInBackground(Command *cmd, const string &jobCmdLine) {
+    PlacementScope placement;
+    if (!placeBackgroundJob(&placement)) {
+        return;
+    }
+    JobOutput output;
+    CaptureScope capture;
+    if (!SmallShell::isSubshell && !SmallShell::jobOutputs->open(&capture, &output)) {
         return;
     }
 
-    history->addRecord(cmd);
+    vector<pid_t> pids;
+    auto externalCmd = dynamic_cast<ExternalCommand *>(cmd);
+    auto pipeCmd = dynamic_cast<PipeCommand *>(cmd);
 
-    if (isBgCmd) {
-        auto pid = fork();
+    if (externalCmd != nullptr) {
+        auto pid = externalCmd->spawn();
+        if (pid != -1) {
+            pids.push_back(pid);
+        }
+    } else if (pipeCmd != nullptr) {
+        pids = pipeCmd->spawn();
+    } else {
+        pid_t pid;
+        {
+            PhaseTimer timer(&TimePhases::spawnNs);
+            pid = fork();
+        }
 
         if (pid == 0) {
             setpgrp();
+            resetSignalsAfterFork();
+            SmallShell::isSubshell = true;
             cmd->execute();
-            exit(0);
+            exit(cmd->status);
         } else if (pid == -1) {
             logSysCallError("fork");
         } else {
-            auto jobStartTime = getCurrentTime();
-            cmd->cmdLine = string(cmdBuffer);
-            jobsList->addJob(cmd, pid, jobStartTime);
-            jobsList->removeFinishedJobs();
-        }
-    } else {
-        cmd->execute();
-
-        if (!isFgCmd(cmd)) {
-            delete SmallShell::fgProcess;
-            auto time = getCurrentTime();
-            SmallShell::fgProcess = new JobEntry(-1, cmd, -1, time);
+            pids.push_back(pid);
         }
+    }
 
-        // Jobs list cleanup (removing finished jobs) should be done after each executed command
-        // https://piazza.com/class/k1yxdx0sx3926r?cid=170
-        jobsList->removeFinishedJobs();
+    if (!pids.empty()) {
+        unique_ptr<JobEntry> job(new JobEntry(pids.front(), jobCmdLine, -1, getMonotonicTime()));
+        job->setPids(pids);
+        SmallShell::jobOutputs->attach(SmallShell::jobsList->addJob(std::move(job))->jobId, &output);
+    } else {
+        SmallShell::jobOutputs->discard(&output);
     }
 }
 
-Command *SmallShell::createCommand(const string &cmdLine) {
-    if (cmdLine.empty()) {
-        return nullptr;
-    }
+void SmallShell::executeCommand(const char *cmdBuffer) {
+    string cmdLine(cmdBuffer);
+    executeCommand(cmdLine, parseCache != nullptr ? parseCache->parse(cmdLine) : parseLine(cmdLine));
+}
 
-    //Check if pipeline or redirection command
-    if (isPipeCommand(cmdLine.c_str()))
-        return new PipeCommand(cmdLine);
+void SmallShell::executeCommand(const string &cmdLine, const ParsedLine &parsed) {
+    commandArena->reset();
+    auto cmd = createCommand(cmdLine, parsed);
 
-    if (isRedirectionCommand(cmdLine.c_str()))
-        return new RedirectionCommand(cmdLine);
+    if (cmd == nullptr) {
+        // Blank lines keep the status, syntax errors and rejected commands fail
+        lastStatus = parsed.list != nullptr && parsed.list->items.empty() ? lastStatus : 1;
+        return;
+    }
 
-    //Regular Command
+    history->addRecord(cmd->cmdLine);
+    if (historyFile != nullptr) {
+        historyFile->append(cmd->cmdLine);
+    }
 
-    char *args_chars[COMMAND_MAX_ARGS];
+    cmd->execute();
+    lastStatus = cmd->status;
 
-    auto args_size = _parseCommandLine(cmdLine.c_str(), args_chars);
+    // Whatever ran in the foreground is done by now, or was moved to the jobs list by ctrl-Z
+    fgProcess.reset();
 
-    string args[COMMAND_MAX_ARGS];
+    // Jobs list cleanup (removing finished jobs) should be done after each executed command
+    // https://piazza.com/class/k1yxdx0sx3926r?cid=170
+    jobsList->removeFinishedJobs();
+    jobsList->printNotices();
+    jobOutputs->drain();
+}
 
-    for (int i = 0; i < args_size; i++) {
-        args[i] = string(args_chars[i]);
-        free(args_chars[i]);
+static Command *createPipelineCommand(const shared_ptr<const ListNode> &line, const PipelineNode &pipeline) {
+    auto &stage = pipeline.stages.front();
+    if (pipeline.stages.size() == 1 && stage.redirections.empty()) {
+        return SmallShell::createSimpleCommand(stage.text);
     }
+    return SmallShell::commandArena->create<PipeCommand>(pipeline.text, line, pipeline);
+}
 
-    string cmd = args[0];
+static Command *createAndOrCommand(const shared_ptr<const ListNode> &line, const AndOrNode &andOr) {
+    if (andOr.pipelines.size() == 1) {
+        return createPipelineCommand(line, andOr.pipelines.front());
+    }
+    return SmallShell::commandArena->create<AndOrCommand>(andOr.text, line, andOr);
+}
 
-    // Jobs list cleanup (removing finished jobs) should be done
-    // before each command that is related to jobs list (jobs,fg,bg,kill,quit kill).
-    // https://piazza.com/class/k1yxdx0sx3926r?cid=170
+Command *SmallShell::createCommand(const string &cmdLine) {
+    return createCommand(cmdLine, parseLine(cmdLine));
+}
 
-    if (cmd == "pwd") {
-        return new GetCurrDirCommand(cmdLine);
-    } else if (cmd == "cd") {
-        if (args_size > 2) {
-            logError("cd: too many arguments");
-        } else {
-            auto arg = args[1];
-            auto isRoot = arg == "-";
+Command *SmallShell::createCommand(const string &cmdLine, const ParsedLine &parsed) {
+    return createCommand(cmdLine, parsed, cmdLine);
+}
 
-            if (isRoot && last_pwd.empty()) {
-                logError("cd: OLDPWD not set");
-            } else {
-                return new ChangeDirCommand(cmdLine.c_str(), isRoot ? last_pwd : arg);
-            }
-        }
-    } else if (cmd == "history") {
-        return new HistoryCommand(cmdLine, history);
-    } else if (cmd == "jobs") {
-        jobsList->removeFinishedJobs();
-        return new JobsCommand(cmdLine, jobsList);
-    } else if (cmd == "showpid") {
-        return new ShowPidCommand(cmdLine);
-    } else if (cmd == "kill") {
-        auto signalInput = args[1];
-        auto signalNumber = parseSignalArg(signalInput);
-        auto jobId = toNumber(args[2]);
-
-        if (args_size > 3 || signalInput[0] != '-' || jobId == -1) {
-            logError("kill: invalid arguments");
-            return nullptr;
-        }
-
-        auto jobEntry = jobsList->getJobById(jobId);
-
-        if (jobEntry == nullptr) {
-            logError("kill: job-id " + to_string(jobId) + " does not exists");
-            return nullptr;
-        }
-
-        jobsList->removeFinishedJobs();
-        return new KillCommand(cmdLine, signalNumber, jobEntry->pid);
-    } else if (cmd == "quit") {
-        bool isKill = args_size > 1 && args[1] == "kill";
-        if (isKill) {
-            jobsList->removeFinishedJobs();
-        }
-        return new QuitCommand(cmdLine, isKill, jobsList);
-    } else if (cmd == "fg") {
-        jobsList->removeFinishedJobs();
-        if (args_size == 1) {
-            auto lastEntry = jobsList->getLastJob();
-
-            if (lastEntry == nullptr) {
-                logError("fg: jobs list is empty");
-                return nullptr;
-            }
-            return new ForegroundCommand(cmdLine, lastEntry);
-        }
+Command *SmallShell::createCommand(const string &cmdLine, const ParsedLine &parsed, const string &jobLine) {
+    // time, limit and pin take the rest of the line as typed, before it is split into commands
+    auto lineBuiltin = findLineBuiltin(cmdLine);
+    if (lineBuiltin != nullptr) {
+        return lineBuiltin(cmdLine, jobLine);
+    }
 
-        auto jobId = toNumber(args[1]);
+    if (parsed.list == nullptr) {
+        logError(parsed.error);
+        return nullptr;
+    }
 
-        if (args_size > 2 || jobId == -1) {
-            logError("fg: invalid arguments");
-            return nullptr;
-        }
+    auto &list = *parsed.list;
+    if (list.items.empty()) {
+        return nullptr;
+    }
 
-        auto jobEntry = jobsList->getJobById(jobId);
+    // A lone foreground command is created from the line as typed, which is what history and jobs show
+    auto &andOr = list.items.front();
+    auto &pipeline = andOr.pipelines.front();
+    if (list.items.size() == 1 && !list.isBackground.front() && andOr.pipelines.size() == 1 &&
+        pipeline.stages.size() == 1 && pipeline.stages.front().redirections.empty()) {
+        return createSimpleCommand(cmdLine);
+    }
 
-        if (jobEntry == nullptr) {
-            logError("fg: job-id " + to_string(jobId) + " does not exists");
-            return nullptr;
-        }
-        return new ForegroundCommand(cmdLine, jobEntry);
-    } else if (cmd == "bg") {
-        if (args_size == 1) {
-            auto lastEntry = jobsList->getLastStoppedJob();
+    return commandArena->create<ListCommand>(jobLine, parsed.list);
+}
 
-            if (lastEntry == nullptr) {
-                logError("bg: there is no stopped jobs to resume");
-                return nullptr;
-            }
+Command *SmallShell::createSimpleCommand(const string &cmdLine) {
 
-            jobsList->removeFinishedJobs();
-            return new BackgroundCommand(cmdLine, lastEntry);
-        }
+    // Reused between lines, so tokenizing never allocates once the buffers have grown to the longest line
+    static Tokenizer args;
 
-        auto jobId = toNumber(args[1]);
+    args.tokenize(cmdLine);
 
-        if (args_size > 2 || jobId == -1) {
-            logError("bg: invalid arguments");
-            return nullptr;
+    auto builtin = findBuiltin(args[0]);
+    if (builtin != nullptr) {
+        return builtin(cmdLine, args);
+    }
+    return commandArena->create<ExternalCommand>(cmdLine);
+}
+
+pid_t ExternalCommand::spawn() {
+    Tokenizer args;
+    auto isDirect = SmallShell::launchMode == LAUNCH_AUTO && canLaunchDirectly(cmdLine.c_str(), args);
+
+    // posix_spawn uses CLONE_VFORK, so the child never copies smash's address space
+    // The child gets its own process group and none of smash's blocked signals (SIGCHLD)
+    sigset_t emptyMask;
+    sigemptyset(&emptyMask);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, SmallShell::isSubshell ? POSIX_SPAWN_SETSIGMASK
+                                                           : POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, &emptyMask);
+
+    pid_t pid = -1;
+    int res;
+
+    if (isDirect) {
+        auto name = args[0].str();
+        auto path = name.find('/') != string::npos ? name : SmallShell::pathCache->lookup(name);
+
+        if (path.empty()) {
+            res = ENOENT;
+        } else {
+            PhaseTimer timer(&TimePhases::spawnNs);
+            res = posix_spawn(&pid, path.c_str(), nullptr, &attr, args.argv(), environ);
         }
+    } else {
+        auto cmdCopy = string(cmdLine);
+        char *args[] = {(char *) "/bin/bash", (char *) "-c", (char *) cmdCopy.c_str(), nullptr};
 
-        auto jobEntry = jobsList->getJobById(jobId);
+        PhaseTimer timer(&TimePhases::spawnNs);
+        res = posix_spawn(&pid, args[0], nullptr, &attr, args, environ);
+    }
 
-        if (jobEntry == nullptr) {
-            logError("bg: job-id " + to_string(jobId) + " does not exists");
-            return nullptr;
-        } else if (!jobEntry->isStopped) {
-            logError("bg: job-id " + to_string(jobId) + " is already running in the background");
-            return nullptr;
-        }
+    posix_spawnattr_destroy(&attr);
 
-        jobsList->removeFinishedJobs();
-        return new BackgroundCommand(cmdLine, jobEntry);
-    } else if (cmd == "cp") {
-        auto pathSource = string(args[1]);
-        auto pathTarget = string(args[2]);
+    if (res != 0) {
+        errno = res;
+        logSysCallError(isDirect ? "execvp" : "execv");
+        return -1;
+    }
+    return pid;
+}
 
-        return new CopyCommand(cmdLine, pathSource, pathTarget);
+void ExternalCommand::exec() {
+    Tokenizer args;
+    if (SmallShell::launchMode == LAUNCH_AUTO && canLaunchDirectly(cmdLine.c_str(), args)) {
+        auto name = args[0].str();
+        auto path = name.find('/') != string::npos ? name : SmallShell::pathCache->lookup(name);
+        if (path.empty()) {
+            errno = ENOENT;
+        } else {
+            execv(path.c_str(), args.argv());
+        }
+        logSysCallError("execvp");
     } else {
-        return new ExternalCommand(cmdLine);
+        auto cmdCopy = string(cmdLine);
+        char *args[] = {(char *) "/bin/bash", (char *) "-c", (char *) cmdCopy.c_str(), nullptr};
+
+        execv(args[0], args);
+        logSysCallError("execv");
     }
-    return nullptr;
+    exit(127);
 }
 
 void ExternalCommand::execute() {
-    auto cmdCopy = string(cmdLine);
+    auto pid = spawn();
 
-    char *args[] = {(char *) "/bin/bash", (char *) "-c", (char *) cmdCopy.c_str(), nullptr};
-    pid_t pid = fork();
-
-    if (pid == 0) {
-        setpgrp();
-        int res = execv(args[0], args);
-        if (res == -1) {
-            logSysCallError("execv");
-        }
-        exit(0);
-
-    } else if (pid == -1) {
-        logSysCallError("fork");
-    } else {
-        setFg(this, pid);
-        int wstatus;
-        waitpid(pid, &wstatus, WUNTRACED);
-    }
+    status = pid == -1 ? 127 : exitStatusOf(waitForeground(setFg(this, pid)));
 }
 
 void ForegroundCommand::execute() {
     job->print();
 
-    auto killRes = kill(job->pid, SIGCONT);
+    auto killRes = kill(-job->pid, SIGCONT);
     if (killRes == -1) {
         logSysCallError("kill");
     } else {
-        // Remove the job from job list after bringing to fg
-        auto jobList = SmallShell::jobsList;
-        jobList->removeJobByPid(job->pid);
-
-        delete SmallShell::fgProcess;
-        SmallShell::fgProcess = job;
+        // Move the job from the jobs list to the fg slot
+        SmallShell::fgProcess = SmallShell::jobsList->releaseJob(job);
+        job->isStopped = false;
 
-        int wstatus;
-        waitpid(job->pid, &wstatus, WUNTRACED);
+        status = exitStatusOf(waitForeground(job));
     }
 }
 
 void BackgroundCommand::execute() {
     job->print();
 
-    auto killRes = kill(job->pid, SIGCONT);
+    auto killRes = kill(-job->pid, SIGCONT);
 
     if (killRes == -1) {
         logSysCallError("kill");
     } else {
-        job->isStopped = false;
+        SmallShell::jobsList->setStopped(job, false);
     }
 }
 
@@ -286,7 +313,7 @@ void ChangeDirCommand::execute() {
         }
     }
 
-    int status = chdir(path.c_str());
+    status = chdir(path.c_str()) == 0 ? 0 : 1;
     if (status != 0) {
         if (!SmallShell::last_pwd.empty()) {
             SmallShell::last_pwd = string(back_up_last_pwd);
@@ -309,17 +336,281 @@ void ShowPidCommand::execute() {
 }
 
 void HistoryCommand::execute() {
-    _history->printHistory();
+    if (!isSearch || SmallShell::historyFile == nullptr) {
+        _history->printHistory(pattern);
+        return;
+    }
+
+    // Reused between searches like the index itself
+    static vector<HistoryMatch> matches;
+    SmallShell::historyFile->search(pattern, &matches);
+    for (auto &match : matches) {
+        cout << right << setw(5) << match.entry << "  ";
+        cout.write(match.line, match.size) << '\n';
+    }
+    cout << flush;
 }
 
 void JobsCommand::execute() {
     jobs->removeFinishedJobs();
-    jobs->printJobsList();
+    jobs->printJobsList(format);
+}
+
+string JobsList::formatNotice(const JobEntry &job) {
+    auto notice = "[" + to_string(job.jobId) + "] ";
+    auto wstatus = job.exitStatus;
+    if (WIFSIGNALED(wstatus)) {
+        notice += strsignal(WTERMSIG(wstatus));
+    } else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0) {
+        notice += "Exit " + to_string(WEXITSTATUS(wstatus));
+    } else {
+        notice += "Done";
+    }
+    return notice + " " + job.cmdLine;
+}
+
+void WaitCommand::execute() {
+    auto jobsList = SmallShell::jobsList;
+    vector<JobEntry *> jobs;
+    status = 0;
+
+    if (jobIds.empty()) {
+        for (int jobId = 1; jobId <= jobsList->getLastJobId(); jobId++) {
+            if (jobsList->getJobById(jobId) != nullptr) {
+                jobs.push_back(jobsList->getJobById(jobId));
+            }
+        }
+    }
+    // operands[i] is the job of jobIds[i], nullptr when there is none
+    vector<JobEntry *> operands;
+    for (auto jobId : jobIds) {
+        auto job = jobsList->getJobById(jobId);
+        if (job == nullptr) {
+            logError("wait: job-id " + to_string(jobId) + " does not exists");
+        } else if (std::find(jobs.begin(), jobs.end(), job) == jobs.end()) {
+            jobs.push_back(job);
+        }
+        operands.push_back(job);
+    }
+
+    JobEntry *first = nullptr;
+    auto result = waitForJobs(jobs, isAny, timeoutMs, &first);
+    if (result == WAIT_NO_CHILDREN) {
+        logError("wait: no children");
+        status = 127;
+        return;
+    } else if (result != WAIT_DONE) {
+        // 124 as timeout(1) exits with
+        status = result == WAIT_TIMEOUT ? 124 : 128 + SIGINT;
+        return;
+    }
+
+    if (isAny) {
+        if (first == nullptr) {
+            // Nothing to wait for, as in bash
+            status = 127;
+        } else {
+            status = exitStatusOf(first->exitStatus);
+            jobsList->removeJobById(first->jobId);
+        }
+        return;
+    }
+
+    // Like bash, the status is the one of the last operand, 127 when it names no job
+    for (auto job : operands) {
+        status = job == nullptr ? 127 : exitStatusOf(job->exitStatus);
+    }
+    // The caller has seen them finish, so they leave the list without a notice
+    for (auto job : jobs) {
+        jobsList->removeJobById(job->jobId);
+    }
+}
+
+void JobLogCommand::execute() {
+    if (!SmallShell::jobOutputs->printTail(jobId)) {
+        logError("joblog: job-id " + to_string(jobId) + " has no output log");
+        status = 1;
+    }
+}
+
+// Reads a small /proc file into buf as a string, returns its size or -1
+static ssize_t readProcFile(const char *path, char *buf, size_t size) {
+    auto fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    auto readCount = read(fd, buf, size - 1);
+    close(fd);
+    buf[max(readCount, (ssize_t) 0)] = '\0';
+    return readCount;
+}
+
+static long procStatusValue(const char *status, const char *name) {
+    auto field = strstr(status, name);
+    return field == nullptr ? 0 : strtol(field + strlen(name), nullptr, 10);
+}
+
+bool addProcessUsage(pid_t pid, JobUsage *usage) {
+    char path[64], buf[4096];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (readProcFile(path, buf, sizeof(buf)) <= 0) {
+        return false;
+    }
+
+    // The command name may hold spaces and parentheses, the fields after it start with the state
+    auto fields = strrchr(buf, ')');
+    char state;
+    long majorFaults, childMajorFaults, user, system, childUser, childSystem;
+    if (fields == nullptr || sscanf(fields + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %ld %ld %ld %ld %ld %ld", &state,
+                                    &majorFaults, &childMajorFaults, &user, &system, &childUser, &childSystem) != 7) {
+        return false;
+    }
+
+    static const int64_t tickNs = 1000000000 / sysconf(_SC_CLK_TCK);
+    usage->userNs += (user + childUser) * tickNs;
+    usage->systemNs += (system + childSystem) * tickNs;
+    usage->majorFaults += majorFaults + childMajorFaults;
+
+    // A zombie has no memory left, and no status lines for it
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (readProcFile(path, buf, sizeof(buf)) > 0) {
+        usage->maxRssKb = max(usage->maxRssKb, procStatusValue(buf, "\nVmHWM:"));
+        usage->voluntarySwitches += procStatusValue(buf, "\nvoluntary_ctxt_switches:");
+        usage->involuntarySwitches += procStatusValue(buf, "\nnonvoluntary_ctxt_switches:");
+    }
+    return true;
+}
+
+// The live children of pid as " (101 102)", which shows the runs of a parallel job or the commands of a forked
+// smash, empty when there are none
+static string formatChildPids(pid_t pid) {
+    char path[64], buf[4096];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, pid);
+    if (readProcFile(path, buf, sizeof(buf)) <= 0) {
+        return "";
+    }
+    string children(buf);
+    children.erase(children.find_last_not_of(' ') + 1);
+    return " (" + children + ")";
+}
+
+JobUsage JobEntry::currentUsage() const {
+    auto current = usage;
+    for (size_t i = 0; i < pids.size(); i++) {
+        if (!isReaped[i]) {
+            addProcessUsage(pids[i], &current);
+        }
+    }
+    return current;
+}
+
+JobEntry::~JobEntry() {
+    if (!cgroupPath.empty() && SmallShell::cgroups != nullptr) {
+        SmallShell::cgroups->removeLeaf(cgroupPath);
+    }
+}
+
+static string formatNs(int64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld.%09lld", (long long) (ns / 1000000000), (long long) (ns % 1000000000));
+    return buf;
+}
+
+static double cpuPercent(const JobUsage &usage, int64_t elapsed) {
+    return elapsed > 0 ? (usage.userNs + usage.systemNs) * 100.0 / elapsed : 0;
+}
+
+void JobsList::printJobUsageLine(const JobEntry &job, int64_t elapsed) {
+    auto usage = job.currentUsage();
+
+    cout << " pids";
+    for (auto pid : job.pids) {
+        cout << " " << pid << formatChildPids(pid);
+    }
+    cout << fixed << setprecision(3) << " user " << usage.userNs / 1e9 << "s sys " << usage.systemNs / 1e9
+         << "s cpu " << setprecision(0) << cpuPercent(usage, elapsed) << "% maxrss " << usage.maxRssKb
+         << "K majflt " << usage.majorFaults << " ctxsw " << usage.voluntarySwitches << "/"
+         << usage.involuntarySwitches;
+    cout.unsetf(ios_base::floatfield);
+    cout << setprecision(6);
+}
+
+void JobsList::printJobUsage(const JobEntry &job, int64_t currentTime) {
+    auto usage = job.currentUsage();
+    auto elapsed = job.elapsed(currentTime);
+
+    cout << "[" << job.jobId << "] " << job.cmdLine << endl;
+    cout << "    pids      ";
+    for (auto pid : job.pids) {
+        cout << " " << pid << formatChildPids(pid);
+    }
+    cout << endl;
+    cout << "    state      " << (job.isFinished ? "done" : (job.isStopped ? "stopped" : "running")) << endl;
+    cout << "    started    " << formatNs(job.startTime) << endl;
+    if (job.isStopped || job.isFinished) {
+        cout << "    " << left << setw(11) << (job.isFinished ? "finished" : "stopped") << formatNs(job.endTime)
+             << endl;
+    }
+    cout << "    elapsed    " << formatNs(elapsed) << " s" << endl;
+    cout << "    user       " << formatNs(usage.userNs) << " s" << endl;
+    cout << "    sys        " << formatNs(usage.systemNs) << " s" << endl;
+    cout << "    cpu        " << fixed << setprecision(1) << cpuPercent(usage, elapsed) << "%" << endl;
+    cout.unsetf(ios_base::floatfield);
+    cout << setprecision(6);
+    cout << "    maxrss     " << usage.maxRssKb << " KB" << endl;
+    cout << "    majflt     " << usage.majorFaults << endl;
+    cout << "    ctxsw      " << usage.voluntarySwitches << " voluntary, " << usage.involuntarySwitches
+         << " involuntary" << endl;
+
+    auto output = SmallShell::jobOutputs->getOutput(job.jobId);
+    if (output != nullptr && output->path.empty()) {
+        cout << "    output     " << output->size << " B kept of " << output->totalBytes << " B" << endl;
+    } else if (output != nullptr) {
+        cout << "    output     " << output->path << endl;
+    }
+
+    CgroupUsage cgroupUsage;
+    if (job.cgroupPath.empty() || !readCgroupUsage(job.cgroupPath, &cgroupUsage)) {
+        return;
+    }
+    cout << "    cgroup     " << job.cgroupPath << endl;
+    cout << "    cg cpu     " << formatNs(cgroupUsage.usageUsec * 1000) << " s" << endl;
+    cout << "    throttled  " << formatNs(cgroupUsage.throttledUsec * 1000) << " s" << endl;
+    if (cgroupUsage.hasMemory) {
+        cout << "    memory     " << cgroupUsage.memoryCurrent << " B, peak " << cgroupUsage.memoryPeak << " B, "
+             << cgroupUsage.oomKills << " oom kills" << endl;
+    }
+    if (cgroupUsage.hasIo) {
+        cout << "    io         " << cgroupUsage.ioReadBytes << " B read, " << cgroupUsage.ioWriteBytes << " B written"
+             << endl;
+    }
+}
+
+void JobsList::printCgroupUsageLine(const JobEntry &job) {
+    CgroupUsage usage;
+    if (!readCgroupUsage(job.cgroupPath, &usage)) {
+        return;
+    }
+
+    cout << fixed << setprecision(3) << " cgroup " << job.cgroupPath.substr(job.cgroupPath.rfind('/') + 1)
+         << " cpu " << usage.usageUsec / 1e6 << "s";
+    if (usage.throttledUsec > 0) {
+        cout << " throttled " << usage.throttledUsec / 1e6 << "s";
+    }
+    if (usage.hasMemory) {
+        cout << " mem " << (usage.memoryCurrent >> 10) << "K peak " << (usage.memoryPeak >> 10) << "K";
+    }
+    if (usage.hasIo) {
+        cout << " io " << (usage.ioReadBytes >> 10) << "K/" << (usage.ioWriteBytes >> 10) << "K";
+    }
+    cout.unsetf(ios_base::floatfield);
+    cout << setprecision(6);
 }
 
 void KillCommand::execute() {
     cout << "signal number " << signal << " was sent to pid " << pid << endl;
-    auto killRes = kill(pid, signal);
+    auto killRes = kill(-pid, signal);
 
     if (killRes == -1) {
         logSysCallError("kill");
@@ -339,197 +630,800 @@ void QuitCommand::execute() {
     exit(0);
 }
 
-void PipeCommand::execute() {
-    int pipeSignIndex = cmdLine.find('|');
-    bool isPipeStdErr = cmdLine[pipeSignIndex + 1] && cmdLine[pipeSignIndex + 1] == '&';
-    auto cmdSource = SmallShell::createCommand(cmdLine.substr(0, pipeSignIndex));
-    auto cmdTarget = SmallShell::createCommand(cmdLine.substr(pipeSignIndex + (int) isPipeStdErr + 1));
-
-    int pipeLine[2];
-    pipe(pipeLine);
+// Opens every redirection target onto its descriptor, in order, returns false after logging a failure
+static bool applyRedirections(const vector<Redirection> &redirections) {
+    for (auto &redirection : redirections) {
+        if (redirection.type == REDIRECT_ERR_TO_OUT) {
+            if (dup2(1, 2) == -1) {
+                logSysCallError("dup2");
+                return false;
+            }
+            continue;
+        }
 
-    auto pid = fork();
+        auto targetFd = 1;
+        auto flags = O_WRONLY | O_CREAT | O_TRUNC;
+        switch (redirection.type) {
+            case REDIRECT_IN:
+                targetFd = 0;
+                flags = O_RDONLY;
+                break;
+            case REDIRECT_APPEND:
+            case REDIRECT_ALL_APPEND:
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+                break;
+            case REDIRECT_ERR:
+                targetFd = 2;
+                break;
+            case REDIRECT_ERR_APPEND:
+                targetFd = 2;
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+                break;
+            default:
+                break;
+        }
+        auto isAll = redirection.type == REDIRECT_ALL || redirection.type == REDIRECT_ALL_APPEND;
 
-    if (pid == -1)//fork fail
-        logSysCallError("fork");
-    else if (!pid) {//son proc
-        setpgrp();
-        if (close(pipeLine[1]) == -1)
-            logSysCallError("close");
-        auto newStdIn = dup(0);
-        if (newStdIn == -1)
-            logSysCallError("dup");
-        if (dup2(pipeLine[0], 0) == -1)
+        auto fd = open(redirection.path.c_str(), flags, 0644);
+        if (fd == -1) {
+            logSysCallError("open");
+            return false;
+        }
+        if (dup2(fd, targetFd) == -1 || (isAll && dup2(fd, 2) == -1)) {
             logSysCallError("dup2");
+            close(fd);
+            return false;
+        }
+        if (fd != targetFd && close(fd) == -1) {
+            logSysCallError("close");
+        }
+    }
+    return true;
+}
 
-        cmdTarget->execute();
+// Runs a builtin inside smash with its redirections applied, then restores smash's own descriptors.
+// A nullptr cmd only applies them, like bash does for a line such as "> file".
+static int executeRedirected(Command *cmd, const vector<Redirection> &redirections) {
+    // Saved out of the way of redirected descriptors and of anything the command spawns
+    int savedFds[3];
+    for (int fd = 0; fd < 3; fd++) {
+        savedFds[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    }
 
-        if (close(pipeLine[0]) == -1 || close(newStdIn) == -1)
-            logSysCallError("close");
+    auto status = 1;
+    cout.flush();
+    if (applyRedirections(redirections)) {
+        if (cmd != nullptr) {
+            cmd->execute();
+            status = cmd->status;
+        } else {
+            status = 0;
+        }
+    }
+    cout.flush();
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (savedFds[fd] != -1 && (dup2(savedFds[fd], fd) == -1 || close(savedFds[fd]) == -1)) {
+            logSysCallError("dup2");
+        }
+    }
+    return status;
+}
+
+// Runs inside the forked stage process and never returns
+static void runPipelineStage(const SimpleCommandNode &stage) {
+    if (!applyRedirections(stage.redirections)) {
+        exit(1);
+    }
+    if (stage.text.empty()) {
         exit(0);
-    } else {//father proc
-        if (close(pipeLine[0]) == -1)
-            logSysCallError("close");
-        if (isPipeStdErr) {
-            auto newStdErr = dup(2);
-            if (newStdErr == -1)
-                logSysCallError("dup");
-            if (dup2(pipeLine[1], 2) == -1)
-                logSysCallError("dup2");
+    }
 
-            if (close(pipeLine[1]) == -1)
-                logSysCallError("close");
+    auto cmd = SmallShell::createSimpleCommand(stage.text);
+    auto externalCmd = dynamic_cast<ExternalCommand *>(cmd);
 
-            cmdSource->execute();
+    if (externalCmd != nullptr) {
+        externalCmd->exec();
+    } else if (cmd != nullptr) {
+        cmd->execute();
+    }
+    exit(cmd == nullptr ? 1 : cmd->status);
+}
 
-            if (dup2(newStdErr, 2) == -1)
-                logSysCallError("dup2");
-            if (close(newStdErr) == -1)
-                logSysCallError("close");
-        } else {
-            auto newStdOut = dup(1);
-            if (newStdOut == -1)
-                logSysCallError("dup");
-            if (dup2(pipeLine[1], 1) == -1)
-                logSysCallError("dup2");
-            if (close(pipeLine[1]) == -1)
-                logSysCallError("close");
+vector<pid_t> PipeCommand::spawn() {
+    auto &stages = pipeline.stages;
+    vector<pid_t> pids;
+
+    auto pipesCount = stages.size() - 1;
+    vector<int> pipeFds(2 * pipesCount, -1);
+    for (size_t i = 0; i < pipesCount; i++) {
+        if (pipe(&pipeFds[2 * i]) == -1) {
+            logSysCallError("pipe");
+            pipesCount = i;
+            break;
+        }
+        // Bigger pipes let a fast producer run further ahead before it has to wait for its consumer
+        if (SmallShell::pipeSize > 0 && fcntl(pipeFds[2 * i + 1], F_SETPIPE_SZ, (int) SmallShell::pipeSize) == -1) {
+            logSysCallError("fcntl");
+        }
+    }
 
-            cmdSource->execute();
+    pid_t pgid = 0;
+    for (size_t i = 0; pipesCount == stages.size() - 1 && i < stages.size(); i++) {
+        pid_t pid;
+        {
+            PhaseTimer timer(&TimePhases::spawnNs);
+            pid = fork();
+        }
 
-            if (dup2(newStdOut, 1) == -1)
+        if (pid == -1) {
+            logSysCallError("fork");
+            break;
+        } else if (pid == 0) {
+            // Stage i reads pipe i - 1 and writes pipe i, all stages join the first stage's group
+            if (!SmallShell::isSubshell) {
+                setpgid(0, pgid);
+            }
+            resetSignalsAfterFork();
+            if (i > 0 && dup2(pipeFds[2 * (i - 1)], 0) == -1) {
                 logSysCallError("dup2");
-            if (close(newStdOut) == -1)
-                logSysCallError("close");
+            }
+            if (i < pipesCount) {
+                if (dup2(pipeFds[2 * i + 1], 1) == -1 ||
+                    (pipeline.pipeStdErr[i] && dup2(pipeFds[2 * i + 1], 2) == -1)) {
+                    logSysCallError("dup2");
+                }
+            }
+            for (auto fd : pipeFds) {
+                close(fd);
+            }
+            runPipelineStage(stages[i]);
         }
-        int wstatus;
-        waitpid(pid, &wstatus, WUNTRACED);
+
+        // Set from both sides, whichever of the parent and the child runs first
+        if (pgid == 0) {
+            pgid = pid;
+        }
+        if (!SmallShell::isSubshell) {
+            setpgid(pid, pgid);
+        }
+        pids.push_back(pid);
     }
-}
 
-void RedirectionCommand::execute() {
-    int redirectionSignIndex = cmdLine.find('>');
+    for (size_t i = 0; i < 2 * pipesCount; i++) {
+        if (close(pipeFds[i]) == -1) {
+            logSysCallError("close");
+        }
+    }
 
-    bool isAppend = cmdLine[redirectionSignIndex + 1] && cmdLine[redirectionSignIndex + 1] == '>';
-    bool justStdOut = cmdLine[redirectionSignIndex - 1] && cmdLine[redirectionSignIndex - 1] != '&';
+    if (pids.size() != stages.size()) {
+        // A partial pipeline is killed, the reaper collects what was started
+        for (auto pid : pids) {
+            kill(pid, SIGKILL);
+        }
+        pids.clear();
+    }
+    return pids;
+}
 
-    auto cmdSourceCopy(cmdLine.substr(0, redirectionSignIndex - 1));
+void PipeCommand::execute() {
+    auto &stage = pipeline.stages.front();
+
+    if (pipeline.stages.size() == 1) {
+        Command *cmd = nullptr;
+        if (!stage.text.empty()) {
+            cmd = SmallShell::createSimpleCommand(stage.text);
+            if (cmd == nullptr) {
+                status = 1;
+                return;
+            }
+        }
+        if (dynamic_cast<ExternalCommand *>(cmd) == nullptr) {
+            status = executeRedirected(cmd, stage.redirections);
+            return;
+        }
+    }
 
-    bool justBgAndOpen = isBackgroundCommand(cmdSourceCopy.c_str());
+    auto pids = spawn();
 
-    removeBackgroundSign((char *) cmdSourceCopy.c_str());
+    if (pids.empty()) {
+        status = 1;
+    } else {
+        auto job = setFg(this, pids.front());
+        job->setPids(pids);
+        status = exitStatusOf(waitForeground(job));
+    }
+}
 
-    auto tweakedCmdLine = string(cmdSourceCopy);
+void AndOrCommand::execute() {
+    status = 0;
+    for (size_t i = 0; i < andOr.pipelines.size(); i++) {
+        // a && b runs b only if a succeeded, a || b only if it failed
+        if (i > 0 && andOr.isOr[i - 1] == (status == 0)) {
+            continue;
+        }
 
-    auto cmd = SmallShell::createCommand(tweakedCmdLine);
+        auto cmd = createPipelineCommand(line, andOr.pipelines[i]);
+        if (cmd == nullptr) {
+            status = 1;
+        } else {
+            cmd->execute();
+            status = cmd->status;
+        }
+    }
+}
 
-    char *args_chars[COMMAND_MAX_ARGS];
-    int args_size = _parseCommandLine((char *) cmdLine.substr(redirectionSignIndex + (int) isAppend + 1)
-            .c_str(), args_chars);
-    if (args_size > 1)
-        perror("too many arguments for redirect");
-    else if (args_size == 0)
-        perror("syntax error near unexpected token `newline'");
-    else {
-        int fdTarget;
-        if (isAppend)
-            fdTarget = open(args_chars[0], O_WRONLY | O_CREAT | O_APPEND, 0644);
-        else
-            fdTarget = open(args_chars[0], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+void ListCommand::execute() {
+    for (size_t i = 0; i < list->items.size(); i++) {
+        auto &andOr = list->items[i];
+        auto cmd = createAndOrCommand(list, andOr);
+
+        if (cmd == nullptr) {
+            status = 1;
+        } else if (list->isBackground[i]) {
+            // Jobs show the line as typed when the job is all of it
+            runInBackground(cmd, list->items.size() == 1 ? cmdLine : andOr.text + "&");
+            status = 0;
+        } else {
+            cmd->execute();
+            status = cmd->status;
+        }
+    }
+}
 
+void HashCommand::execute() {
+    if (isReset) {
+        cache->reset();
+    } else {
+        cache->print();
+    }
+}
 
-        if (fdTarget == -1)
+void TeeCommand::execute() {
+    vector<int> fds(1, STDOUT_FILENO);
+    for (auto &file : files) {
+        auto fd = open(file.c_str(), O_WRONLY | O_CREAT | (isAppend ? O_APPEND : O_TRUNC), 0644);
+        if (fd == -1) {
             logSysCallError("open");
-        else {
-
-            if (justBgAndOpen) {
-                if (close(fdTarget) == -1)
-                    logSysCallError("close");
-
-                auto pid = fork();
-
-                if (pid == 0) {
-                    setpgrp();
-                    cmd->execute();
-                    exit(0);
-                } else if (pid == -1) {
-                    logSysCallError("fork");
-                } else {
-                    auto jobStartTime = getCurrentTime();
-                    cmd->cmdLine = string(tweakedCmdLine);
-                    SmallShell::jobsList->addJob(cmd, pid, jobStartTime);
-//                    shell removes finished jobs when going back in the func stack
-                }
-            } else {
-                auto newStdout = dup(1);
-                auto newStdErr = dup(2);
+        } else {
+            fds.push_back(fd);
+        }
+    }
 
-                if (newStdout == -1 || newStdErr == -1)
-                    logSysCallError("dup");
-                if (dup2(fdTarget, 1) == -1)
-                    logSysCallError("dup2");
+    // stdout goes last: it consumes the data from stdin while the files get tee(2) duplicates
+    std::reverse(fds.begin(), fds.end());
+    relayData(STDIN_FILENO, fds, SmallShell::pipeSize);
 
-                if (!justStdOut) {
-                    if (dup2(fdTarget, 2) == -1)
-                        logSysCallError("dup2");
-                }
+    for (size_t i = 0; i + 1 < fds.size(); i++) {
+        if (close(fds[i]) == -1) {
+            logSysCallError("close");
+        }
+    }
+}
 
-                if (close(fdTarget) == -1)
-                    logSysCallError("close");
+static int64_t rusageNs(const struct timeval &time) {
+    return (int64_t) time.tv_sec * 1000000000 + time.tv_usec * 1000;
+}
 
-                cmd->execute();
+// User and sys time of smash and of the children it reaped, in nanoseconds
+static void getCpuTimes(int64_t *userNs, int64_t *systemNs) {
+    struct rusage self, children;
+    if (getrusage(RUSAGE_SELF, &self) == -1 || getrusage(RUSAGE_CHILDREN, &children) == -1) {
+        logSysCallError("getrusage");
+        *userNs = *systemNs = 0;
+        return;
+    }
+    *userNs = rusageNs(self.ru_utime) + rusageNs(children.ru_utime);
+    *systemNs = rusageNs(self.ru_stime) + rusageNs(children.ru_stime);
+}
 
-                if (!justStdOut) {
-                    if (dup2(newStdErr, 2) == -1)
-                        logSysCallError("dup2");
-                }
+void TimeCommand::execute() {
+    TimePhases phases = {0, 0};
+    auto outerPhases = SmallShell::timePhases;
+    SmallShell::timePhases = &phases;
 
-                if (dup2(newStdout, 1) == -1)
-                    logSysCallError("dup2");
-                if (close(newStdout) == -1 || close(newStdErr) == -1)
-                    logSysCallError("close");
+    int64_t userStart, systemStart, userEnd, systemEnd;
+    getCpuTimes(&userStart, &systemStart);
+    auto start = getMonotonicTime();
 
-            }
+    auto parsed = parseLine(timedLine);
+    auto cmd = SmallShell::createCommand(timedLine, parsed, cmdLine);
+    auto created = getMonotonicTime();
 
-        }
+    if (cmd != nullptr) {
+        cmd->execute();
+        status = cmd->status;
+    } else {
+        status = parsed.list == nullptr || !parsed.list->items.empty() ? 1 : 0;
+    }
+
+    auto end = getMonotonicTime();
+    getCpuTimes(&userEnd, &systemEnd);
+
+    SmallShell::timePhases = outerPhases;
+    if (outerPhases != nullptr) {
+        outerPhases->spawnNs += phases.spawnNs;
+        outerPhases->waitNs += phases.waitNs;
+    }
+
+    // Like bash, a line that does not parse is not timed
+    if (parsed.list == nullptr) {
+        return;
+    }
+
+    // Whatever execute spent neither creating nor waiting for processes was spent in smash
+    auto parseNs = created - start;
+    auto execNs = max(end - created - phases.spawnNs - phases.waitNs, (int64_t) 0);
+    auto realNs = end - start;
+    auto userNs = userEnd - userStart;
+    auto systemNs = systemEnd - systemStart;
+
+    if (isJson) {
+        cout << "{\"real_ns\":" << realNs << ",\"user_ns\":" << userNs << ",\"sys_ns\":" << systemNs
+             << ",\"parse_ns\":" << parseNs << ",\"spawn_ns\":" << phases.spawnNs << ",\"exec_ns\":" << execNs
+             << ",\"wait_ns\":" << phases.waitNs << ",\"status\":" << status << "}" << endl;
+        return;
     }
+
+    cout << "real\t" << formatNs(realNs) << endl;
+    cout << "user\t" << formatNs(userNs) << endl;
+    cout << "sys\t" << formatNs(systemNs) << endl;
+    cout << "parse\t" << formatNs(parseNs) << endl;
+    cout << "spawn\t" << formatNs(phases.spawnNs) << endl;
+    cout << "exec\t" << formatNs(execNs) << endl;
+    cout << "wait\t" << formatNs(phases.waitNs) << endl;
 }
 
-void CopyCommand::execute() {
+void LimitCommand::execute() {
+    status = 1;
+    auto parsed = parseLine(limitedLine);
+    if (parsed.list == nullptr) {
+        logError(parsed.error);
+        return;
+    }
 
-    auto fdSource = open(source.c_str(), O_RDONLY);
-    auto fdTarget = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    // A single command ending with & becomes a background job, any other line runs in the foreground as a whole
+    auto &list = *parsed.list;
+    auto isBackground = list.items.size() == 1 && list.isBackground.front();
+    auto cmd = SmallShell::createCommand(isBackground ? list.items.front().text : limitedLine);
+    if (cmd == nullptr) {
+        return;
+    }
 
-    if (fdSource == -1 || fdTarget == -1) {
-        logSysCallError("open");
+    if (SmallShell::cgroups == nullptr) {
+        SmallShell::cgroups = new JobCgroups();
+    }
+    string cgroupPath;
+    auto cgroupFd = SmallShell::cgroups->createLeaf(limits, &cgroupPath);
+    if (cgroupFd == -1) {
+        return;
+    }
+
+    PlacementScope placement;
+    JobOutput output;
+    CaptureScope capture;
+    if (isBackground && (!placeBackgroundJob(&placement) ||
+                         (!SmallShell::isSubshell && !SmallShell::jobOutputs->open(&capture, &output)))) {
+        close(cgroupFd);
+        SmallShell::cgroups->removeLeaf(cgroupPath);
+        return;
+    }
+
+    // forkIntoCgroup may be a raw clone3, which skips glibc's fork handlers, yet the child runs cmd (iostreams, new)
+    // before any exec. That is only safe while smash has a single thread here: copy joins its workers before it
+    // returns, and nothing may start a thread that outlives its command.
+    pid_t pid;
+    {
+        PhaseTimer timer(&TimePhases::spawnNs);
+        pid = forkIntoCgroup(cgroupFd, cgroupPath);
+    }
+    close(cgroupFd);
+
+    if (pid == 0) {
+        if (!SmallShell::isSubshell) {
+            setpgid(0, 0);
+        }
+        resetSignalsAfterFork();
+        SmallShell::isSubshell = true;
+        auto externalCmd = dynamic_cast<ExternalCommand *>(cmd);
+        if (externalCmd != nullptr) {
+            externalCmd->exec();
+        }
+        cmd->execute();
+        exit(cmd->status);
+    } else if (pid == -1) {
+        SmallShell::cgroups->removeLeaf(cgroupPath);
+        SmallShell::jobOutputs->discard(&output);
+        return;
+    }
+    // Set from both sides, whichever of the parent and the child runs first
+    if (!SmallShell::isSubshell) {
+        setpgid(pid, pid);
+    }
+
+    if (isBackground) {
+        unique_ptr<JobEntry> job(new JobEntry(pid, cmdLine, -1, getMonotonicTime()));
+        job->cgroupPath = cgroupPath;
+        SmallShell::jobOutputs->attach(SmallShell::jobsList->addJob(std::move(job))->jobId, &output);
+        status = 0;
     } else {
-        char buf[1024];
+        auto job = setFg(this, pid);
+        job->cgroupPath = cgroupPath;
+        status = exitStatusOf(waitForeground(job));
+    }
+}
+
+void PinCommand::execute() {
+    status = 1;
+    PlacementScope scope;
+    if (!scope.apply(placement)) {
+        return;
+    }
+
+    auto wasPinned = SmallShell::isPinned;
+    SmallShell::isPinned = true;
+    auto cmd = SmallShell::createCommand(pinnedLine, parseLine(pinnedLine), cmdLine);
+    if (cmd != nullptr) {
+        cmd->execute();
+        status = cmd->status;
+    }
+    SmallShell::isPinned = wasPinned;
+}
+
+// Quotes an argument for the line of a run unless it is a plain word
+static string quoteArg(const string &arg) {
+    static const char *const plainChars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_./:=@%+,-";
+    if (!arg.empty() && arg.find_first_not_of(plainChars) == string::npos) {
+        return arg;
+    }
+    string quoted = "'";
+    for (auto c : arg) {
+        quoted += c == '\'' ? string("'\\''") : string(1, c);
+    }
+    return quoted + "'";
+}
 
-        while (true) {
-            auto readCount = read(fdSource, &buf, 1024);
+// Every {} of the command is replaced by the argument, a command without {} gets it appended
+static string runLine(const string &command, const string &arg) {
+    auto quoted = quoteArg(arg);
+    string line;
+    size_t start = 0, at;
+    while ((at = command.find("{}", start)) != string::npos) {
+        line += command.substr(start, at - start) + quoted;
+        start = at + 2;
+    }
+    return start == 0 ? command + " " + quoted : line + command.substr(start);
+}
+
+void ParallelCommand::execute() {
+    // A forked smash (background job, pipeline stage) is a job already and schedules in place
+    if (getSignalPipeFd() == -1) {
+        status = schedule();
+        return;
+    }
 
-            if (readCount == -1) {
-                logSysCallError("read");
-            } else if (readCount == 0) {
+    pid_t pid;
+    {
+        PhaseTimer timer(&TimePhases::spawnNs);
+        pid = fork();
+    }
+
+    if (pid == 0) {
+        setpgrp();
+        resetSignalsAfterFork();
+        exit(schedule());
+    } else if (pid == -1) {
+        logSysCallError("fork");
+        status = 1;
+        return;
+    }
+    setpgid(pid, pid);
+    status = exitStatusOf(waitForeground(setFg(this, pid)));
+}
+
+// A run whose output is not printed yet, with -k
+struct ParallelRun {
+    bool isReaped;
+    // Read end of the run's stdout, -1 at EOF
+    int outputFd;
+    // What the run wrote while an earlier run was still printing
+    string output;
+};
+
+int ParallelCommand::schedule() {
+    // SIGCHLD is only taken from the signalfd, so no run can exit unnoticed between two polls
+    sigset_t childMask, savedMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &savedMask);
+    auto childFd = signalfd(-1, &childMask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (childFd == -1) {
+        logSysCallError("signalfd");
+        sigprocmask(SIG_SETMASK, &savedMask, nullptr);
+        return 1;
+    }
+
+    // Runs stay in the scheduler's process group, and their commands come from an arena of their own
+    auto wasSubshell = SmallShell::isSubshell;
+    auto shellArena = SmallShell::commandArena;
+    Arena runArena;
+    SmallShell::isSubshell = true;
+    SmallShell::commandArena = &runArena;
+    auto stdoutFd = isOrdered ? fcntl(1, F_DUPFD_CLOEXEC, 3) : -1;
+
+    // Run number of each live pid, and with -k the runs from the first one not printed yet
+    unordered_map<pid_t, size_t> running;
+    deque<ParallelRun> runs;
+    size_t firstRun = 0, runCount = 0, nextArg = 0;
+    int failed = 0;
+    deque<string> stdinArgs;
+    string stdinLine;
+    auto isStdinOpen = !hasArgs;
+    char buf[PIPE_BUF];
+
+    while (true) {
+        while (running.size() < jobs && (hasArgs ? nextArg < args.size() : !stdinArgs.empty())) {
+            string arg;
+            if (hasArgs) {
+                arg = args[nextArg++];
+            } else {
+                arg = std::move(stdinArgs.front());
+                stdinArgs.pop_front();
+            }
+
+            int outputPipe[2] = {-1, -1};
+            if (isOrdered && (pipe2(outputPipe, O_CLOEXEC) == -1 || fcntl(outputPipe[0], F_SETFL, O_NONBLOCK) == -1 ||
+                              dup2(outputPipe[1], 1) == -1)) {
+                logSysCallError("pipe");
+            }
+            close(outputPipe[1]);
+
+            runArena.reset();
+            auto cmd = SmallShell::createCommand(runLine(command, arg));
+            auto externalCmd = dynamic_cast<ExternalCommand *>(cmd);
+            pid_t pid = -1;
+            if (externalCmd != nullptr) {
+                pid = externalCmd->spawn();
+            } else if (cmd != nullptr && (pid = fork()) == 0) {
+                resetSignalsAfterFork();
+                cmd->execute();
+                exit(cmd->status);
+            } else if (pid == -1 && cmd != nullptr) {
+                logSysCallError("fork");
+            }
+
+            if (isOrdered && dup2(stdoutFd, 1) == -1) {
+                logSysCallError("dup2");
+            }
+            if (pid > 0) {
+                running[pid] = runCount;
+            } else {
+                failed++;
+            }
+            if (isOrdered) {
+                runs.push_back({pid <= 0, outputPipe[0], string()});
+            }
+            runCount++;
+        }
+
+        if (running.empty() && (hasArgs ? nextArg == args.size() : !isStdinOpen && stdinArgs.empty()) &&
+            runs.empty()) {
+            break;
+        }
+
+        // Arguments are read from stdin only when a run could start, so a slow producer is never outpaced
+        vector<struct pollfd> fds;
+        fds.push_back({childFd, POLLIN, 0});
+        auto isReadingStdin = isStdinOpen && stdinArgs.empty() && running.size() < jobs;
+        if (isReadingStdin) {
+            fds.push_back({0, POLLIN, 0});
+        }
+        for (auto &run : runs) {
+            if (run.outputFd != -1) {
+                fds.push_back({run.outputFd, POLLIN, 0});
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno != EINTR) {
+                logSysCallError("poll");
                 break;
             }
+            continue;
+        }
 
-            auto writeRes = write(fdTarget, &buf, readCount);
+        if (isReadingStdin && fds[1].revents != 0) {
+            auto readCount = read(0, buf, sizeof(buf));
+            if (readCount <= 0) {
+                isStdinOpen = false;
+                if (!stdinLine.empty()) {
+                    stdinArgs.push_back(std::move(stdinLine));
+                }
+            }
+            for (ssize_t i = 0; i < readCount; i++) {
+                if (buf[i] != '\n') {
+                    stdinLine += buf[i];
+                } else if (!stdinLine.empty()) {
+                    stdinArgs.push_back(std::move(stdinLine));
+                    stdinLine.clear();
+                }
+            }
+        }
 
-            if (writeRes == -1) {
-                logSysCallError("read");
+        // The first run not printed yet writes straight through, later ones are kept until it is done. One read
+        // per poll, so a chatty run does not starve the others.
+        for (size_t i = 0; i < runs.size(); i++) {
+            auto &run = runs[i];
+            auto readCount = run.outputFd == -1 ? -1 : read(run.outputFd, buf, sizeof(buf));
+            if (readCount > 0 && i == 0) {
+                writeAll(1, buf, readCount);
+            } else if (readCount > 0) {
+                run.output.append(buf, readCount);
+            } else if (run.outputFd != -1 && (readCount == 0 || errno != EAGAIN)) {
+                close(run.outputFd);
+                run.outputFd = -1;
             }
+        }
 
+        // Several SIGCHLDs may coalesce into one siginfo, waitpid tells which runs are done
+        struct signalfd_siginfo info;
+        while (read(childFd, &info, sizeof(info)) == sizeof(info)) {
+        }
+        int wstatus;
+        pid_t pid;
+        while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+            auto it = running.find(pid);
+            if (it == running.end()) {
+                continue;
+            }
+            if (exitStatusOf(wstatus) != 0) {
+                failed++;
+            }
+            if (isOrdered) {
+                runs[it->second - firstRun].isReaped = true;
+            }
+            running.erase(it);
+        }
 
+        while (!runs.empty() && runs.front().isReaped && runs.front().outputFd == -1) {
+            runs.pop_front();
+            firstRun++;
+            if (!runs.empty()) {
+                writeAll(1, runs.front().output.data(), runs.front().output.size());
+                string().swap(runs.front().output);
+            }
         }
+    }
+
+    for (auto &run : runs) {
+        close(run.outputFd);
+    }
+    if (stdoutFd != -1) {
+        close(stdoutFd);
+    }
+    close(childFd);
+    sigprocmask(SIG_SETMASK, &savedMask, nullptr);
+    SmallShell::commandArena = shellArena;
+    SmallShell::isSubshell = wasSubshell;
+    return min(failed, 101);
+}
 
-        auto closeSource = close(fdSource);
-        auto closeTarget = close(fdTarget);
+void SetCommand::execute() {
+    CopyMethod method;
+    auto number = toNumber(value);
+
+    if (option.empty()) {
+        cout << "launch=" << (SmallShell::launchMode == LAUNCH_BASH ? "bash" : "auto") << endl;
+        cout << "copyengine=" << copyMethodName(copyEngine) << endl;
+        cout << "uringdepth=" << copyUringDepth << endl;
+        cout << "pipesize=" << SmallShell::pipeSize << endl;
+        cout << "histsize=" << SmallShell::historySize << endl;
+        cout << "histmem=" << SmallShell::history->getBudget() << endl;
+        cout << "histcontrol=" << (SmallShell::history->getControl() == HISTORY_ERASEDUPS ? "erasedups" : "ignoredups")
+             << endl;
+        auto policy = SmallShell::placer->getPolicy();
+        cout << "pin=" << (policy == PIN_CORES ? "cores" : (policy == PIN_NODES ? "nodes" : "off")) << endl;
+        auto jobOutputs = SmallShell::jobOutputs;
+        auto mode = jobOutputs->getMode();
+        cout << "output=" << (mode == CAPTURE_RING ? "ring" : (mode == CAPTURE_FILE ? "file" : "tty")) << endl;
+        cout << "outbuf=" << jobOutputs->getRingSize() << endl;
+        cout << "outmax=" << jobOutputs->getMaxMemory() << endl;
+        cout << "notify=" << (SmallShell::jobsList->getNotifying() ? "on" : "off") << endl;
+    } else if (option == "launch" && (value == "auto" || value == "bash")) {
+        SmallShell::launchMode = value == "bash" ? LAUNCH_BASH : LAUNCH_AUTO;
+    } else if (option == "copyengine" && parseCopyMethod(value, &method)) {
+        copyEngine = method;
+    } else if (option == "uringdepth" && number > 0 && number <= 4096) {
+        copyUringDepth = number;
+    } else if (option == "pipesize" && parseSize(value) >= 0 && parseSize(value) <= INT_MAX) {
+        SmallShell::pipeSize = parseSize(value);
+    } else if (option == "histmem" && parseSize(value) > 0) {
+        SmallShell::history->setBudget(parseSize(value));
+    } else if (option == "histcontrol" && (value == "ignoredups" || value == "erasedups")) {
+        SmallShell::history->setControl(value == "erasedups" ? HISTORY_ERASEDUPS : HISTORY_IGNOREDUPS);
+    } else if (option == "pin" && (value == "off" || value == "cores" || value == "nodes")) {
+        SmallShell::placer->setPolicy(value == "cores" ? PIN_CORES : (value == "nodes" ? PIN_NODES : PIN_OFF));
+    } else if (option == "output" && (value == "tty" || value == "ring" || value == "file")) {
+        SmallShell::jobOutputs->setMode(value == "ring" ? CAPTURE_RING
+                                                        : (value == "file" ? CAPTURE_FILE : CAPTURE_TTY));
+    } else if (option == "outbuf" && parseSize(value) > 0) {
+        SmallShell::jobOutputs->setRingSize(parseSize(value));
+    } else if (option == "outmax" && parseSize(value) > 0) {
+        SmallShell::jobOutputs->setMaxMemory(parseSize(value));
+    } else if (option == "notify" && (value == "on" || value == "off")) {
+        SmallShell::jobsList->setNotifying(value == "on");
+    } else if (option == "histsize" && number > 0) {
+        SmallShell::historySize = number;
+        if (SmallShell::historyFile != nullptr) {
+            SmallShell::historyFile->setMaxEntries(number);
+        }
+    } else {
+        logError("set: invalid option " + option + "=" + value);
+    }
+}
 
-        if (closeSource == -1 || closeTarget == -1) {
-            logSysCallError("open");
+void CopyCommand::executeParallel() {
+    CopyStats stats;
+    auto isCopied = copyParallel(source, target, isRecursive, max(threads, 1), &stats);
+
+    if (isCopied) {
+        cout << "smash: " << source << " was copied to " << target << endl;
+    }
+
+    auto seconds = max(stats.seconds, 1e-9);
+    cout << "smash: cp: " << stats.files << " files, " << stats.bytes << " bytes in " << fixed
+         << setprecision(3) << stats.seconds << " secs (" << setprecision(1)
+         << stats.bytes / seconds / (1 << 20) << " MB/s, " << stats.files / seconds << " files/s)" << endl;
+    cout.unsetf(ios_base::floatfield);
+    cout << setprecision(6);
+}
+
+void CopyCommand::execute() {
+    if (isRecursive || threads > 0) {
+        executeParallel();
+        return;
+    }
+
+    auto fdSource = open(source.c_str(), O_RDONLY);
+    if (fdSource == -1) {
+        logSysCallError("open");
+        return;
+    }
+
+    struct stat sourceStat, targetStat;
+    if (fstat(fdSource, &sourceStat) == 0 && S_ISDIR(sourceStat.st_mode)) {
+        logError("cp: -r not specified; omitting directory " + source);
+        close(fdSource);
+        return;
+    }
+
+    // The target is truncated only after making sure it is not the source itself
+    auto fdTarget = open(target.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fdTarget == -1) {
+        logSysCallError("open");
+        close(fdSource);
+        return;
+    }
+
+    auto isSameFile = fstat(fdTarget, &targetStat) == 0 &&
+                      sourceStat.st_dev == targetStat.st_dev && sourceStat.st_ino == targetStat.st_ino;
+
+    auto isCopied = isSameFile;
+    if (!isSameFile) {
+        CopyMethod method;
+        if (ftruncate(fdTarget, 0) == -1) {
+            logSysCallError("ftruncate");
         } else {
-            cout << "smash: " << source << " was copied to " << target << endl;
+            isCopied = copyFileContent(fdSource, fdTarget, &method) != -1;
         }
     }
+
+    auto closeSource = close(fdSource);
+    auto closeTarget = close(fdTarget);
+
+    if (closeSource == -1 || closeTarget == -1) {
+        logSysCallError("close");
+    } else if (isCopied) {
+        cout << "smash: " << source << " was copied to " << target << endl;
+    }
 }
@@ -4,22 +4,34 @@
 #include <utility>
 #include <vector>
 #include <iomanip>
+#include <unordered_map>
+#include <memory>
 #include "utils.h"
+#include "parser.h"
+#include "arena.h"
+#include "history.h"
+#include "cgroup.h"
+#include "placement.h"
+#include "joboutput.h"
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #define COMMAND_ARGS_MAX_LENGTH (200)
-#define COMMAND_MAX_ARGS (20)
-#define HISTORY_MAX_RECORDS (50)
+// Bytes the session history may use (set histmem=...), and the ring capacity it starts with
+#define HISTORY_DEFAULT_BUDGET (64 << 10)
+#define HISTORY_MIN_RING (16)
 #define COMMAND_LENGTH (80)
-#define MAX_JOBS (100)
 
 using namespace std;
 
 class Command {
 public:
     string cmdLine;
+    // Exit status of the last execute(), as $? would report it
+    int status;
 
-    explicit Command(string cmdLine) : cmdLine(std::move(cmdLine)) {
+    explicit Command(string cmdLine) : cmdLine(std::move(cmdLine)), status(0) {
 
     }
 
@@ -32,107 +44,272 @@ public:
     // TODO: Add your extra methods if needed
 };
 
+// Resources used by the processes of a job
+struct JobUsage {
+    int64_t userNs;
+    int64_t systemNs;
+    long maxRssKb;
+    long majorFaults;
+    long voluntarySwitches;
+    long involuntarySwitches;
+
+    JobUsage() : userNs(0), systemNs(0), maxRssKb(0), majorFaults(0), voluntarySwitches(0),
+                 involuntarySwitches(0) {}
+
+    // wait4 reports the process together with the children it reaped
+    void add(const struct rusage &usage) {
+        userNs += (int64_t) usage.ru_utime.tv_sec * 1000000000 + usage.ru_utime.tv_usec * 1000;
+        systemNs += (int64_t) usage.ru_stime.tv_sec * 1000000000 + usage.ru_stime.tv_usec * 1000;
+        maxRssKb = std::max(maxRssKb, usage.ru_maxrss);
+        majorFaults += usage.ru_majflt;
+        voluntarySwitches += usage.ru_nvcsw;
+        involuntarySwitches += usage.ru_nivcsw;
+    }
+};
+
+// Adds what the live process pid has used so far, its reaped children included, as read from /proc.
+// Returns false if the process is gone.
+bool addProcessUsage(pid_t pid, JobUsage *usage);
+
+// Every job leads its own process group, so pid is also the group id that job signals are sent to
 struct JobEntry {
     pid_t pid;
-    Command *cmd;
+    // All processes of the job (the stages of a pipeline), pid first
+    vector<pid_t> pids;
+    vector<bool> isReaped;
+    // Processes of the job that were not reaped yet
+    size_t livePids;
+    // A copy, the command that started the job only lives as long as its line
+    string cmdLine;
     int jobId;
-    time_t startTime;
-    time_t endTime;
+    // CLOCK_MONOTONIC nanoseconds, endTime is set when the job stops or finishes
+    int64_t startTime;
+    int64_t endTime;
     bool isStopped;
-
-    JobEntry(pid_t pid, Command *cmd,
+    bool isFinished;
+    // Raw wait status, valid once isFinished is set
+    int exitStatus;
+    // Of the processes reaped so far
+    JobUsage usage;
+    // The cgroup leaf of a job started by limit, removed with the job
+    string cgroupPath;
+    // Intrusive links of JobsList's stopped-jobs list
+    JobEntry *prevStopped;
+    JobEntry *nextStopped;
+
+    JobEntry(pid_t pid, string cmdLine,
              int jobId,
-             time_t startTime,
-             time_t endTime = -1,
+             int64_t startTime,
+             int64_t endTime = -1,
              bool isStopped = false) : pid(pid),
-                                       cmd(cmd),
+                                       pids(1, pid),
+                                       isReaped(1, false),
+                                       livePids(1),
+                                       cmdLine(std::move(cmdLine)),
                                        jobId(jobId),
                                        startTime(startTime),
-                                       endTime(),
-                                       isStopped(isStopped) {}
+                                       endTime(endTime),
+                                       isStopped(isStopped),
+                                       isFinished(false),
+                                       exitStatus(-1),
+                                       usage(),
+                                       cgroupPath(),
+                                       prevStopped(nullptr),
+                                       nextStopped(nullptr) {}
+
+    ~JobEntry();
+
+    void setPids(const vector<pid_t> &jobPids) {
+        pid = jobPids.front();
+        pids = jobPids;
+        isReaped.assign(jobPids.size(), false);
+        livePids = jobPids.size();
+    }
 
-    void print() {
-        std::cout << pid << ": " << cmd->cmdLine << endl;
+    // Accounts for a process of the job that exited or was killed, a pipeline finishes with its last
+    // stage's status. Returns true when no process of the job is left.
+    bool reap(pid_t reapedPid, int wstatus, const struct rusage &reapedUsage) {
+        if (reapedPid == pids.back()) {
+            exitStatus = wstatus;
+        }
+        for (size_t i = 0; i < pids.size(); i++) {
+            if (pids[i] == reapedPid) {
+                isReaped[i] = true;
+            }
+        }
+        usage.add(reapedUsage);
+        return livePids > 0 && --livePids == 0;
+    }
+
+    // The usage of the reaped processes plus a sample of the live ones
+    JobUsage currentUsage() const;
+
+    int64_t elapsed(int64_t now) const {
+        return (isStopped || isFinished ? endTime : now) - startTime;
     }
 
-    static bool entriesCompare(JobEntry *j1, JobEntry *j2) {
-        return j1->jobId < j2->jobId;
+    void print() {
+        std::cout << pid << ": " << cmdLine << endl;
     }
 };
 
+enum JobsFormat {
+    JOBS_DEFAULT, // id, command, pid, elapsed seconds
+    JOBS_LONG,    // jobs -l: also the pids and resource usage, on one line
+    JOBS_VERBOSE  // jobs -v: one value per line, times in nanoseconds
+};
 
+// The list owns its jobs. A job leaves it for the fg slot (fg) and comes back when stopped (ctrl-Z),
+// the unique_ptr moving along with it.
 class JobsList {
-public:
-
+    // slots[jobId] holds the job with that id, slot 0 is never used and the last slot is never empty,
+    // so the next job id (highest id + 1) is always slots.size()
+    vector<unique_ptr<JobEntry>> slots;
+    unordered_map<pid_t, JobEntry *> byPid;
+    // Stopped jobs in the order they stopped, and the one with the highest id, which bg resumes
+    JobEntry *stoppedHead;
+    JobEntry *stoppedTail;
+    JobEntry *highestStopped;
+    size_t jobsCount;
+    // Leading pids of the jobs reaped since the last removeFinishedJobs, a job may be gone by then
+    vector<pid_t> finished;
+    // Under set notify=on (bash's set -b) removing a finished job leaves a notice for printNotices
+    bool isNotifying;
+    vector<string> notices;
+
+    void linkStopped(JobEntry *job) {
+        job->prevStopped = stoppedTail;
+        job->nextStopped = nullptr;
+        if (stoppedTail == nullptr) {
+            stoppedHead = job;
+        } else {
+            stoppedTail->nextStopped = job;
+        }
+        stoppedTail = job;
+        if (highestStopped == nullptr || job->jobId > highestStopped->jobId) {
+            highestStopped = job;
+        }
+    }
 
-    vector<JobEntry *> jobs;
+    void unlinkStopped(JobEntry *job) {
+        if (job->prevStopped == nullptr) {
+            stoppedHead = job->nextStopped;
+        } else {
+            job->prevStopped->nextStopped = job->nextStopped;
+        }
+        if (job->nextStopped == nullptr) {
+            stoppedTail = job->prevStopped;
+        } else {
+            job->nextStopped->prevStopped = job->prevStopped;
+        }
+        job->prevStopped = nullptr;
+        job->nextStopped = nullptr;
+
+        // Only resuming the highest one costs a walk over the jobs still stopped
+        if (job == highestStopped) {
+            highestStopped = stoppedHead;
+            for (auto stopped = stoppedHead; stopped != nullptr; stopped = stopped->nextStopped) {
+                if (stopped->jobId > highestStopped->jobId) {
+                    highestStopped = stopped;
+                }
+            }
+        }
+    }
 
-    JobsList() : jobs() {
+public:
+    JobsList() : slots(1), byPid(), stoppedHead(nullptr), stoppedTail(nullptr), highestStopped(nullptr),
+                 jobsCount(0), finished(), isNotifying(false), notices() {
     };
 
     ~JobsList() = default;
 
+    size_t size() const {
+        return jobsCount;
+    }
 
     int getLastJobId() {
-        int max = 0;
-        for (auto &job : jobs) {
-            auto jobId = job->jobId;
-            if (jobId > max) {
-                max = jobId;
-            }
-        }
-        return max;
+        return (int) slots.size() - 1;
+    }
+
+    JobEntry *addJob(const string &cmdLine, pid_t pid, int64_t startTime, bool isStopped = false) {
+        auto currentTime = getMonotonicTime();
+        return addJob(unique_ptr<JobEntry>(new JobEntry(pid, cmdLine, -1, startTime, currentTime, isStopped)));
     }
 
-    void addJob(Command *cmd, pid_t pid, time_t startTime, bool isStopped = false) {
-        time_t currentTime;
-        auto resTime = time(&currentTime);
+    // Jobs coming back from the foreground keep their id unless it was handed out meanwhile
+    JobEntry *addJob(unique_ptr<JobEntry> owned) {
+        auto job = owned.get();
+        if (job->jobId <= 0 || (job->jobId < (int) slots.size() && slots[job->jobId] != nullptr)) {
+            job->jobId = (int) slots.size();
+        }
+        if (job->jobId >= (int) slots.size()) {
+            slots.resize(job->jobId + 1);
+        }
+
+        slots[job->jobId] = std::move(owned);
+        for (auto pid : job->pids) {
+            byPid[pid] = job;
+        }
+        jobsCount++;
 
-        if (resTime == -1) {
-            logSysCallError("time");
+        if (job->isStopped) {
+            linkStopped(job);
         }
-        auto lastId = getLastJobId();
-        jobs.push_back(new JobEntry(pid, cmd, (int) lastId + 1, startTime, currentTime, isStopped));
+        return job;
     }
 
-    void addJob(JobEntry *job) {
-        if (job->jobId != -1) {
-            jobs.push_back(job);
+    void setStopped(JobEntry *job, bool isStopped) {
+        if (job->isStopped == isStopped) {
+            return;
+        }
+        job->isStopped = isStopped;
+        if (isStopped) {
+            linkStopped(job);
         } else {
-            auto lastId = getLastJobId();
-            job->jobId = lastId + 1;
-            jobs.push_back(job);
+            unlinkStopped(job);
         }
     }
 
-    void printJobsList() {
-        sort(jobs.begin(), jobs.end(), JobEntry::entriesCompare);
-        for (auto jobEntry : jobs) {
-            auto jobId = jobEntry->jobId;
-            auto cmd_line = jobEntry->cmd->cmdLine;
-            auto pid = jobEntry->pid;
-            auto startTime = jobEntry->startTime;
-            auto endTime = jobEntry->endTime;
-            auto isStopped = jobEntry->isStopped;
-
-            time_t currentTime;
-            auto resTime = time(&currentTime);
+    void printJobsList(JobsFormat format = JOBS_DEFAULT) {
+        auto currentTime = getMonotonicTime();
 
-            if (resTime == -1) {
-                logSysCallError("time");
+        for (auto &jobEntry : slots) {
+            if (jobEntry == nullptr) {
+                continue;
             }
+            auto isStopped = jobEntry->isStopped;
+            auto elapsed = jobEntry->elapsed(currentTime);
 
-            auto time = difftime(isStopped ? endTime : currentTime, startTime);
+            if (format == JOBS_VERBOSE) {
+                printJobUsage(*jobEntry, currentTime);
+                continue;
+            }
 
-            cout << "[" << jobId << "] " << cmd_line << " : " << pid << " " << time << " secs" <<
-                 (isStopped ? " (stopped)" : "") << endl;
+            cout << "[" << jobEntry->jobId << "] " << jobEntry->cmdLine << " : " << jobEntry->pid << " "
+                 << elapsed / 1000000000 << " secs" << (isStopped ? " (stopped)" : "");
+            if (format == JOBS_LONG) {
+                printJobUsageLine(*jobEntry, elapsed);
+            }
+            if (!jobEntry->cgroupPath.empty()) {
+                printCgroupUsageLine(*jobEntry);
+            }
+            cout << endl;
         }
     }
 
+    static void printJobUsageLine(const JobEntry &job, int64_t elapsed);
+
+    static void printJobUsage(const JobEntry &job, int64_t currentTime);
+
+    static void printCgroupUsageLine(const JobEntry &job);
+
     void killAllJobs() {
-        cout << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:" << endl;
-        for (auto &job : jobs) {
-            auto killRes = kill(job->pid, SIGKILL);
+        cout << "smash: sending SIGKILL signal to " << jobsCount << " jobs:" << endl;
+        for (auto &job : slots) {
+            if (job == nullptr) {
+                continue;
+            }
+            auto killRes = kill(-job->pid, SIGKILL);
             if (killRes == -1) {
                 logSysCallError("kill");
             } else {
@@ -141,161 +318,384 @@ public:
         }
     }
 
-    void removeFinishedJobs() {
-        for (size_t i = 0; i < jobs.size(); i++) {
-            auto job = jobs[i];
-            int status;
-            int waitRes = waitpid(job->pid, &status, WNOHANG | WUNTRACED);
-            if ((waitRes > 0 && status == 0) || WIFSTOPPED(status)) {
-                jobs.erase(jobs.begin() + i);
+    // Collects every child that changed state since the last call, costs O(changed children).
+    // Must not run while a foreground child is being waited for, children that are no longer jobs
+    // (killed with the kill builtin) are simply reaped.
+    void reapChildren() {
+        int status;
+        pid_t pid;
+        struct rusage usage;
+        while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+            auto job = getJobByPid(pid);
+            if (job == nullptr) {
+                continue;
+            }
+
+            if (WIFSTOPPED(status)) {
+                job->endTime = getMonotonicTime();
+                setStopped(job, true);
+            } else if (WIFCONTINUED(status)) {
+                setStopped(job, false);
+            } else if (job->reap(pid, status, usage)) {
+                job->isFinished = true;
+                job->endTime = getMonotonicTime();
+                finished.push_back(job->pid);
             }
         }
     }
 
-    JobEntry *getJobById(int jobId) {
-        for (auto &job : jobs) {
-            if (job->jobId == jobId) {
-                return job;
+    void removeFinishedJobs() {
+        reapChildren();
+        for (auto pid : finished) {
+            auto job = getJobByPid(pid);
+            if (job != nullptr && job->isFinished) {
+                if (isNotifying) {
+                    notices.push_back(formatNotice(*job));
+                }
+                releaseJob(job);
             }
         }
-        return nullptr;
+        finished.clear();
     }
 
-    JobEntry *getJobByPid(pid_t pid) {
-        for (auto &job : jobs) {
-            if (job->pid == pid) {
-                return job;
-            }
+    // "[3] Done sleep 10&", "[3] Exit 1 ..." or "[3] Killed ..."
+    static string formatNotice(const JobEntry &job);
+
+    bool getNotifying() const {
+        return isNotifying;
+    }
+
+    void setNotifying(bool notifying) {
+        isNotifying = notifying;
+        notices.clear();
+    }
+
+    bool hasNotices() const {
+        return !notices.empty();
+    }
+
+    void printNotices() {
+        for (auto &notice : notices) {
+            cout << notice << endl;
         }
-        return nullptr;
+        notices.clear();
+    }
+
+    JobEntry *getJobById(int jobId) {
+        return jobId > 0 && jobId < (int) slots.size() ? slots[jobId].get() : nullptr;
+    }
+
+    JobEntry *getJobByPid(pid_t pid) {
+        auto it = byPid.find(pid);
+        return it == byPid.end() ? nullptr : it->second;
     }
 
     void removeJobById(int jobId) {
-        for (std::size_t i = 0; i < jobs.size(); i++) {
-            auto _jobId = jobs[i]->jobId;
-            if (_jobId == jobId) {
-                jobs.erase(jobs.begin() + i);
-                return;
-            }
+        auto job = getJobById(jobId);
+        if (job != nullptr) {
+            releaseJob(job);
         }
     }
 
     void removeJobByPid(pid_t pid) {
-        for (std::size_t i = 0; i < jobs.size(); i++) {
-            auto job = jobs[i];
-            if (pid == job->pid) {
-                jobs.erase(jobs.begin() + i);
-                return;
-            }
+        auto job = getJobByPid(pid);
+        if (job != nullptr) {
+            releaseJob(job);
+        }
+    }
+
+    // Hands the job over to the caller, used to move it to the fg slot
+    unique_ptr<JobEntry> releaseJob(JobEntry *job) {
+        if (job->isStopped) {
+            unlinkStopped(job);
         }
+        for (auto pid : job->pids) {
+            byPid.erase(pid);
+        }
+        auto owned = std::move(slots[job->jobId]);
+        while (slots.size() > 1 && slots.back() == nullptr) {
+            slots.pop_back();
+        }
+        jobsCount--;
+        return owned;
     }
 
     JobEntry *getLastJob() {
-        return jobs.empty() ? nullptr : jobs.back();
+        return slots.back().get();
     }
 
     JobEntry *getLastStoppedJob() {
-        auto i = jobs.end();
-        while (i != jobs.begin()) {
-            --i;
+        return highestStopped;
+    }
+};
+
+// Maps command names to the absolute path of the executable found in $PATH, like bash's hash table.
+// The table is dropped when PATH changes, and an entry is dropped when the mtime of the directory it
+// was found in changes, so a hit costs one stat of that directory instead of a walk over all of PATH.
+class PathCache {
+    struct Entry {
+        string path;
+        size_t dirIndex;
+        struct timespec dirMtime;
+        int hits;
+    };
+
+    string pathEnv;
+    vector<string> dirs;
+    unordered_map<string, Entry> entries;
+    long hits;
+    long misses;
+
+    static bool isSameTime(const struct timespec &t1, const struct timespec &t2) {
+        return t1.tv_sec == t2.tv_sec && t1.tv_nsec == t2.tv_nsec;
+    }
+
+    static bool isExecutable(const string &path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(path.c_str(), X_OK) == 0;
+    }
 
-            if ((*i)->isStopped) {
-                return *i;
+    void refreshPath() {
+        auto env = getenv("PATH");
+        string current = env == nullptr ? "/bin:/usr/bin" : env;
+
+        if (current == pathEnv && !dirs.empty()) {
+            return;
+        }
+
+        entries.clear();
+        dirs.clear();
+        pathEnv = current;
+
+        size_t start = 0;
+        while (true) {
+            auto end = pathEnv.find(':', start);
+            auto dir = pathEnv.substr(start, end == string::npos ? string::npos : end - start);
+            dirs.push_back(dir.empty() ? "." : dir);
+            if (end == string::npos) {
+                break;
             }
+            start = end + 1;
         }
-        return nullptr;
     }
-};
 
-class CommandsHistory {
-private:
-    int current_index;
-    bool isOverlap;
-    int time;
 public:
-    class CommandHistoryEntry {
-        int timestamp;
+    PathCache() : pathEnv(), dirs(), entries(), hits(0), misses(0) {}
+
+    ~PathCache() = default;
+
+    // Returns the absolute path of the executable, or an empty string if it is not in PATH
+    string lookup(const string &name) {
+        refreshPath();
+
+        auto it = entries.find(name);
+        if (it != entries.end()) {
+            struct stat st;
+            auto &entry = it->second;
+            if (stat(dirs[entry.dirIndex].c_str(), &st) == 0 && isSameTime(st.st_mtim, entry.dirMtime)) {
+                hits++;
+                entry.hits++;
+                return entry.path;
+            }
+            entries.erase(it);
+        }
 
-    public:
-        Command *cmd;
+        misses++;
+        for (size_t i = 0; i < dirs.size(); i++) {
+            auto candidate = dirs[i] + "/" + name;
+            if (!isExecutable(candidate)) {
+                continue;
+            }
 
-        CommandHistoryEntry() : timestamp(), cmd() {}
+            // Relative PATH entries depend on the working directory, so they are never cached
+            struct stat st;
+            if (dirs[i][0] == '/' && stat(dirs[i].c_str(), &st) == 0) {
+                entries[name] = Entry{candidate, i, st.st_mtim, 1};
+            }
+            return candidate;
+        }
+        return "";
+    }
 
-        explicit CommandHistoryEntry(Command *cmd, int timestamp) : timestamp(timestamp), cmd(cmd) {}
+    void reset() {
+        entries.clear();
+        dirs.clear();
+        pathEnv.clear();
+        hits = 0;
+        misses = 0;
+    }
 
-        void setTimestamp(int time) {
-            timestamp = time;
+    void print() {
+        if (!entries.empty()) {
+            cout << "hits\tcommand" << endl;
+            for (auto &entry : entries) {
+                cout << right << setw(4) << entry.second.hits << "\t" << entry.second.path << endl;
+            }
         }
+        cout << "smash: hash: " << hits << " hits, " << misses << " misses" << endl;
+    }
+};
 
-        bool isEqual(const string &cmd_line) {
-            return cmd->cmdLine == cmd_line;
-        }
+enum HistoryControl {
+    HISTORY_IGNOREDUPS, // a line repeating the previous one only renumbers it
+    HISTORY_ERASEDUPS   // a line seen before also drops its previous entry, so every line is listed once
+};
 
-        void print() {
-            cout << right << setw(5) << timestamp << "  " << cmd->cmdLine << endl;
-        }
+// Session history: a ring of entries pointing to interned lines. The ring, the lines and the map interning
+// them are kept within a budget in bytes by evicting the oldest entries, so a deep history costs what it
+// holds and not a fixed number of records.
+class CommandsHistory {
+    struct InternedLine {
+        int refs;
+        // Ring position of the latest entry of the line
+        size_t lastPosition;
+    };
+
+    typedef unordered_map<string, InternedLine>::value_type Line;
+
+    struct Entry {
+        // nullptr once erasedups dropped the entry
+        Line *line;
+        int timestamp;
     };
 
-    CommandsHistory() : current_index(0), isOverlap(false), time(0), history() {
+    unordered_map<string, InternedLine> lines;
+    size_t linesBytes;
+    // Positions only grow, an entry lives at position & (ring.size() - 1) and ring.size() is a power of 2
+    vector<Entry> ring;
+    size_t first;
+    size_t end;
+    int time;
+    size_t budget;
+    HistoryControl control;
 
+    Entry &at(size_t position) {
+        return ring[position & (ring.size() - 1)];
     }
 
-    ~CommandsHistory() = default;
+    static size_t lineBytes(const string &cmdLine) {
+        // The hash map node holds the pair and its next pointer, and the cached hash
+        return sizeof(Line) + 2 * sizeof(void *) + cmdLine.size() + 1;
+    }
 
-    CommandHistoryEntry *history[HISTORY_MAX_RECORDS];
+    size_t usedBytes() const {
+        return ring.size() * sizeof(Entry) + linesBytes + lines.bucket_count() * sizeof(void *);
+    }
 
-    void addRecord(Command *cmd) {
-        increaseTime();
-        auto lastIndex = (current_index == 0 ? HISTORY_MAX_RECORDS : current_index) - 1;
+    void release(Line *line) {
+        if (--line->second.refs == 0) {
+            linesBytes -= lineBytes(line->first);
+            lines.erase(line->first);
+        }
+    }
 
-        auto last = history[lastIndex];
-        if (last != nullptr && last->isEqual(cmd->cmdLine)) {
-            last->setTimestamp(time);
-        } else {
-            history[current_index] = new CommandHistoryEntry(cmd, time);
-            current_index++;
+    void evictOldest() {
+        auto &oldest = at(first++);
+        if (oldest.line != nullptr) {
+            release(oldest.line);
         }
+    }
+
+    void resizeRing(size_t capacity) {
+        vector<Entry> resized(capacity);
+        for (auto position = first; position < end; position++) {
+            resized[position & (capacity - 1)] = at(position);
+        }
+        ring.swap(resized);
+    }
 
-        if (current_index == HISTORY_MAX_RECORDS) {
-            current_index = 0;
-            if (!isOverlap) {
-                isOverlap = true;
+    // Evicts until the history fits the budget again, keeping at least the newest entry
+    void fitBudget() {
+        while (usedBytes() > budget && end - first > 1) {
+            if (ring.size() > HISTORY_MIN_RING && end - first <= ring.size() / 2) {
+                resizeRing(ring.size() / 2);
+            } else if (lines.bucket_count() > 4 * lines.size() + HISTORY_MIN_RING) {
+                // Buckets are never given back by erase
+                lines.rehash(0);
+            } else {
+                evictOldest();
             }
         }
     }
 
-    void printHistory() {
-        int printIndex = isOverlap ? current_index : 0;
-        int startIndex = printIndex;
-        int printedOnce = false;
+public:
+    CommandsHistory() : lines(), linesBytes(0), ring(HISTORY_MIN_RING), first(0), end(0), time(0),
+                        budget(HISTORY_DEFAULT_BUDGET), control(HISTORY_IGNOREDUPS) {
 
-        while (true) {
-            if ((isOverlap && printedOnce && printIndex == startIndex) ||
-                (!isOverlap && printIndex == HISTORY_MAX_RECORDS)) {
-                break;
+    }
+
+    ~CommandsHistory() = default;
+
+    void addRecord(const string &cmdLine) {
+        time++;
+
+        if (end > first) {
+            auto &last = at(end - 1);
+            if (last.line != nullptr && last.line->first == cmdLine) {
+                last.timestamp = time;
+                return;
             }
-            auto current = history[printIndex];
-            printIndex++;
+        }
 
-            if (isOverlap && printIndex == HISTORY_MAX_RECORDS) {
-                printIndex = 0;
+        auto found = lines.find(cmdLine);
+        if (found == lines.end()) {
+            found = lines.emplace(cmdLine, InternedLine{0, 0}).first;
+            linesBytes += lineBytes(cmdLine);
+        }
+        auto line = &*found;
+        line->second.refs++;
+
+        if (control == HISTORY_ERASEDUPS && line->second.refs > 1) {
+            auto &previous = at(line->second.lastPosition);
+            if (line->second.lastPosition >= first && previous.line == line) {
+                previous.line = nullptr;
+                line->second.refs--;
             }
+        }
 
-            if (current == nullptr) {
+        if (end - first == ring.size()) {
+            if (usedBytes() + ring.size() * sizeof(Entry) <= budget) {
+                resizeRing(ring.size() * 2);
+            } else {
+                evictOldest();
+            }
+        }
+
+        at(end) = {line, time};
+        line->second.lastPosition = end++;
+        fitBudget();
+    }
+
+    // Prints the entries containing pattern, all of them when it is empty
+    void printHistory(const string &pattern = "") {
+        for (auto position = first; position < end; position++) {
+            auto &entry = at(position);
+            if (entry.line == nullptr || entry.line->first.find(pattern) == string::npos) {
                 continue;
             }
-            current->print();
-            printedOnce = true;
+            cout << right << setw(5) << entry.timestamp << "  " << entry.line->first << endl;
         }
     }
 
-    void increaseTime() {
-        time++;
+    void setBudget(size_t bytes) {
+        budget = bytes;
+        fitBudget();
+    }
+
+    size_t getBudget() const {
+        return budget;
+    }
+
+    void setControl(HistoryControl historyControl) {
+        control = historyControl;
+    }
+
+    HistoryControl getControl() const {
+        return control;
     }
 
-    Command *getLastCmd() {
-        auto lastIndex = (isOverlap && current_index == 0 ? HISTORY_MAX_RECORDS : current_index) - 1;
-        return history[lastIndex]->cmd;
+    size_t size() const {
+        return end - first;
     }
 };
 
@@ -308,36 +708,65 @@ public:
     ~BuiltInCommand() override = default;
 };
 
+enum LaunchMode {
+    LAUNCH_AUTO, // simple command lines are spawned directly, everything else goes through bash
+    LAUNCH_BASH  // every external command goes through /bin/bash -c
+};
+
 class ExternalCommand : public Command {
 public:
     explicit ExternalCommand(string cmdLine) : Command(std::move(cmdLine)) {};
 
     ~ExternalCommand() override = default;
 
+    // Starts the command in its own process group without waiting for it, returns -1 on failure
+    pid_t spawn();
+
+    // Replaces the current process with the command, used by forked pipeline stages
+    void exec();
+
     void execute() override;
 };
 
+// The nodes of parsed commands point into the tree of their line, which they keep alive
 class PipeCommand : public Command {
-    // TODO: Add your data members
+    shared_ptr<const ListNode> line;
+    const PipelineNode &pipeline;
 public:
-    explicit PipeCommand(string cmdLine) : Command(std::move(cmdLine)) {};
+    PipeCommand(string cmdLine, shared_ptr<const ListNode> line, const PipelineNode &pipeline)
+            : Command(std::move(cmdLine)), line(std::move(line)), pipeline(pipeline) {};
 
     virtual ~PipeCommand() {}
 
+    // Forks every stage into one new process group without waiting, returns the pids (empty on failure)
+    vector<pid_t> spawn();
+
+    // A lone builtin runs inside smash with its redirections applied around it, anything else is spawned
     void execute() override;
 };
 
-class RedirectionCommand : public Command {
-    // TODO: Add your data members
+// Pipelines joined by && and ||, each one runs only if the status so far allows it
+class AndOrCommand : public Command {
+    shared_ptr<const ListNode> line;
+    const AndOrNode &andOr;
 public:
-    explicit RedirectionCommand(string cmdLine) : Command(std::move(cmdLine)) {};
+    AndOrCommand(string cmdLine, shared_ptr<const ListNode> line, const AndOrNode &andOr)
+            : Command(std::move(cmdLine)), line(std::move(line)), andOr(andOr) {};
+
+    virtual ~AndOrCommand() {}
+
+    void execute() override;
+};
 
+// A parsed command line, its items run one after the other or as background jobs
+class ListCommand : public Command {
+    shared_ptr<const ListNode> list;
+public:
+    ListCommand(string cmdLine, shared_ptr<const ListNode> list) : Command(std::move(cmdLine)), list(std::move(list)) {};
 
-    virtual ~RedirectionCommand() {}
+    virtual ~ListCommand() {}
 
     void execute() override;
-    //void prepare() override;
-    //void cleanup() override;
 };
 
 /* ================ Built In Commands ================ */
@@ -355,7 +784,7 @@ public:
 
 class ChangeDirCommand : public BuiltInCommand {
 public:
-    const string &path;
+    const string path;
 
 
     explicit ChangeDirCommand(const char *cmd_line, const string &path) : BuiltInCommand(cmd_line), path(path) {
@@ -369,9 +798,15 @@ public:
 
 class HistoryCommand : public BuiltInCommand {
     CommandsHistory *_history;
+    // history -s searches the history file, or the session history when there is none
+    bool isSearch;
+    string pattern;
 public:
-    explicit HistoryCommand(string cmdLine, CommandsHistory *history) : BuiltInCommand(cmdLine),
-                                                                        _history(history) {
+    explicit HistoryCommand(string cmdLine, CommandsHistory *history, bool isSearch = false, string pattern = "")
+            : BuiltInCommand(std::move(cmdLine)),
+              _history(history),
+              isSearch(isSearch),
+              pattern(std::move(pattern)) {
 
     }
 
@@ -404,8 +839,11 @@ public:
 
 class JobsCommand : public BuiltInCommand {
     JobsList *jobs;
+    JobsFormat format;
 public:
-    JobsCommand(string cmdLine, JobsList *jobs) : BuiltInCommand(std::move(cmdLine)), jobs(jobs) {
+    JobsCommand(string cmdLine, JobsList *jobs, JobsFormat format = JOBS_DEFAULT) : BuiltInCommand(std::move(cmdLine)),
+                                                                                   jobs(jobs),
+                                                                                   format(format) {
     }
 
     ~JobsCommand() override = default;
@@ -413,6 +851,35 @@ public:
     void execute() override;
 };
 
+// Blocks until the jobs (every job when none is given) are done, exiting with the status of the last one. With
+// isAny it returns when the first of them is done, with its status.
+class WaitCommand : public BuiltInCommand {
+    vector<int> jobIds;
+    bool isAny;
+    // -1 waits as long as it takes
+    int timeoutMs;
+public:
+    WaitCommand(string cmdLine, vector<int> jobIds, bool isAny, int timeoutMs) : BuiltInCommand(std::move(cmdLine)),
+                                                                                jobIds(std::move(jobIds)),
+                                                                                isAny(isAny),
+                                                                                timeoutMs(timeoutMs) {}
+
+    ~WaitCommand() override = default;
+
+    void execute() override;
+};
+
+// Prints the tail of what a background job wrote under set output=ring|file, after the job is gone too
+class JobLogCommand : public BuiltInCommand {
+    int jobId;
+public:
+    JobLogCommand(string cmdLine, int jobId) : BuiltInCommand(std::move(cmdLine)), jobId(jobId) {}
+
+    ~JobLogCommand() override = default;
+
+    void execute() override;
+};
+
 class KillCommand : public BuiltInCommand {
     int signal;
     pid_t pid;
@@ -450,36 +917,215 @@ public:
 class CopyCommand : public BuiltInCommand {
     string source;
     string target;
+    bool isRecursive;
+    // Worker threads for -j, 0 copies in place on the shell's thread
+    int threads;
+
+    void executeParallel();
 public:
-    CopyCommand(string cmdLine, string source, string target) : BuiltInCommand(std::move(cmdLine)),
-                                                                source(std::move(source)),
-                                                                target(std::move(target)) {}
+    CopyCommand(string cmdLine, string source, string target, bool isRecursive = false, int threads = 0)
+            : BuiltInCommand(std::move(cmdLine)),
+              source(std::move(source)),
+              target(std::move(target)),
+              isRecursive(isRecursive),
+              threads(threads) {}
 
     ~CopyCommand() override = default;
 
     void execute() override;
 };
 
+class HashCommand : public BuiltInCommand {
+    PathCache *cache;
+    bool isReset;
+public:
+    HashCommand(string cmdLine, PathCache *cache, bool isReset) : BuiltInCommand(std::move(cmdLine)),
+                                                                  cache(cache),
+                                                                  isReset(isReset) {}
+
+    ~HashCommand() override = default;
+
+    void execute() override;
+};
+
+// Relays stdin to stdout and to every file, without copying through userspace when stdin is a pipe
+class TeeCommand : public BuiltInCommand {
+    vector<string> files;
+    bool isAppend;
+public:
+    TeeCommand(string cmdLine, vector<string> files, bool isAppend) : BuiltInCommand(std::move(cmdLine)),
+                                                                      files(std::move(files)),
+                                                                      isAppend(isAppend) {}
+
+    ~TeeCommand() override = default;
+
+    void execute() override;
+};
+
+// Runs the rest of its line (parsed on its own, so parsing is part of what it measures) and reports the wall,
+// user and sys time, with the wall time split into parse, spawn, exec and wait
+class TimeCommand : public BuiltInCommand {
+    string timedLine;
+    bool isJson;
+public:
+    TimeCommand(string cmdLine, string timedLine, bool isJson) : BuiltInCommand(std::move(cmdLine)),
+                                                                 timedLine(std::move(timedLine)),
+                                                                 isJson(isJson) {}
+
+    ~TimeCommand() override = default;
+
+    void execute() override;
+};
+
+// Runs the rest of its line as one job in a cgroup leaf of its own with the given limits, in the background
+// when the line is a single command ending with &
+class LimitCommand : public BuiltInCommand {
+    CgroupLimits limits;
+    string limitedLine;
+public:
+    LimitCommand(string cmdLine, CgroupLimits limits, string limitedLine) : BuiltInCommand(std::move(cmdLine)),
+                                                                         limits(std::move(limits)),
+                                                                         limitedLine(std::move(limitedLine)) {}
+
+    ~LimitCommand() override = default;
+
+    void execute() override;
+};
+
+// Runs the rest of its line with smash's CPU affinity and memory policy set as asked, which is what everything
+// started by the line inherits
+class PinCommand : public BuiltInCommand {
+    Placement placement;
+    string pinnedLine;
+public:
+    PinCommand(string cmdLine, Placement placement, string pinnedLine) : BuiltInCommand(std::move(cmdLine)),
+                                                                       placement(std::move(placement)),
+                                                                       pinnedLine(std::move(pinnedLine)) {}
+
+    ~PinCommand() override = default;
+
+    void execute() override;
+};
+
+// Runs command once per argument with at most jobs runs at a time, like xargs -P. The runs share the process
+// group of one scheduler, so the whole batch is a single job that ctrl-C, ctrl-Z, fg and kill act on.
+class ParallelCommand : public BuiltInCommand {
+    string command;
+    vector<string> args;
+    // Without ::: the arguments are the lines of stdin
+    bool hasArgs;
+    size_t jobs;
+    // Each run's stdout goes through a pipe and is printed in the order of the arguments
+    bool isOrdered;
+
+    // Returns the number of failed runs, capped at 101 as GNU parallel does
+    int schedule();
+public:
+    ParallelCommand(string cmdLine, string command, vector<string> args, bool hasArgs, size_t jobs, bool isOrdered)
+            : BuiltInCommand(std::move(cmdLine)),
+              command(std::move(command)),
+              args(std::move(args)),
+              hasArgs(hasArgs),
+              jobs(jobs),
+              isOrdered(isOrdered) {}
+
+    ~ParallelCommand() override = default;
+
+    void execute() override;
+};
+
+class SetCommand : public BuiltInCommand {
+    string option;
+    string value;
+public:
+    SetCommand(string cmdLine, string option, string value) : BuiltInCommand(std::move(cmdLine)),
+                                                              option(std::move(option)),
+                                                              value(std::move(value)) {}
+
+    ~SetCommand() override = default;
+
+    void execute() override;
+};
+
 /* ================ Shell ================ */
 
+// Time spent creating processes (posix_spawn returns once the child has exec'd, fork right away) and
+// waiting for them, collected while a time builtin runs
+struct TimePhases {
+    int64_t spawnNs;
+    int64_t waitNs;
+};
+
 class SmallShell {
 private:
     SmallShell() {
         last_pwd = "";
         history = new CommandsHistory();
+        historyFile = nullptr;
+        historySize = HISTORY_DEFAULT_SIZE;
         jobsList = new JobsList();
-        fgProcess = nullptr;
+        pathCache = new PathCache();
+        commandArena = new Arena();
+        launchMode = LAUNCH_AUTO;
+        pipeSize = 0;
+        isSubshell = false;
+        parseCache = nullptr;
+        lastStatus = 0;
+        timePhases = nullptr;
+        cgroups = nullptr;
+        placer = new JobPlacer();
+        isPinned = false;
+        jobOutputs = new JobOutputs();
     }
 
 
 public:
     static string last_pwd;
     static CommandsHistory *history;
+    // Lines are also appended to it when set, which main does for interactive shells or with SMASH_HISTFILE
+    static HistoryFile *historyFile;
+    // Entries kept in the history file (set histsize=...)
+    static size_t historySize;
     static JobsList *jobsList;
-    static JobEntry *fgProcess;
-
+    static PathCache *pathCache;
+    // Owns the job being waited for in the foreground, ctrl-Z moves it into jobsList
+    static unique_ptr<JobEntry> fgProcess;
+    // Every command created for a line, freed when the next line starts. Jobs, history and the fg slot
+    // keep copies of the command lines they need.
+    static Arena *commandArena;
+    static LaunchMode launchMode;
+    // Capacity requested for pipeline pipes with F_SETPIPE_SZ, 0 keeps the kernel default
+    static size_t pipeSize;
+
+    // Set in a forked smash running a background job, whose processes stay in its process group
+    static bool isSubshell;
+
+    // Lines are parsed through it when set (script mode), otherwise every line is parsed afresh
+    static ParseCache *parseCache;
+    // Exit status of the last line, which is what a script exits with
+    static int lastStatus;
+    // Set while a time builtin runs
+    static TimePhases *timePhases;
+    // Created by the first limit builtin
+    static JobCgroups *cgroups;
+    // Places background jobs under set pin=cores|nodes, except on lines run by the pin builtin (isPinned)
+    static JobPlacer *placer;
+    static bool isPinned;
+    // Where background jobs write (set output=tty|ring|file) and the logs of the captured ones
+    static JobOutputs *jobOutputs;
+
+    // Parses a whole line, returns nullptr after logging a syntax error or when a lone command is invalid
     static Command *createCommand(const string &cmdLine);
 
+    static Command *createCommand(const string &cmdLine, const ParsedLine &parsed);
+
+    // jobLine is what jobs started by the line show, the whole typed line when cmdLine is what a prefix left of it
+    static Command *createCommand(const string &cmdLine, const ParsedLine &parsed, const string &jobLine);
+
+    // Returns the builtin or external command for the words of one simple command
+    static Command *createSimpleCommand(const string &cmdLine);
+
+
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
     static SmallShell &getInstance() { // makes SmallShell singleton
@@ -487,9 +1133,34 @@ public:
         return instance; // Instantiated on first use.
     }
 
-    ~SmallShell() = default;
+    // Runs when smash exits or quits, so no job output file is left behind in $TMPDIR
+    ~SmallShell() {
+        delete jobOutputs;
+    }
 
     static void executeCommand(const char *cmdBuffer);
+
+    static void executeCommand(const string &cmdLine, const ParsedLine &parsed);
+};
+
+// Adds the time until it goes out of scope to a phase of the running time builtin, costs nothing otherwise
+class PhaseTimer {
+    int64_t *phase;
+    int64_t start;
+public:
+    explicit PhaseTimer(int64_t TimePhases::*member)
+            : phase(SmallShell::timePhases == nullptr ? nullptr : &(SmallShell::timePhases->*member)),
+              start(phase == nullptr ? 0 : getMonotonicTime()) {}
+
+    ~PhaseTimer() {
+        if (phase != nullptr) {
+            *phase += getMonotonicTime() - start;
+        }
+    }
+
+    PhaseTimer(PhaseTimer const &) = delete;
+
+    void operator=(PhaseTimer const &) = delete;
 };
 
 #endif //SMASH_COMMAND_H_
@@ -0,0 +1,840 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "copy.h"
+#include "uring.h"
+#include "utils.h"
+
+using namespace std;
+
+CopyMethod copyEngine = COPY_AUTO;
+unsigned copyUringDepth = COPY_URING_DEFAULT_DEPTH;
+
+// Result of a single copy method
+#define COPY_DONE (1)
+#define COPY_UNSUPPORTED (0)
+#define COPY_FAILED (-1)
+
+const char *copyMethodName(CopyMethod method) {
+    switch (method) {
+        case COPY_AUTO:
+            return "auto";
+        case COPY_REFLINK:
+            return "reflink";
+        case COPY_FILE_RANGE:
+            return "copy_file_range";
+        case COPY_SENDFILE:
+            return "sendfile";
+        case COPY_URING:
+            return "io_uring";
+        default:
+            return "read_write";
+    }
+}
+
+bool parseCopyMethod(const string &name, CopyMethod *method) {
+    for (auto candidate = (int) COPY_AUTO; candidate <= (int) COPY_READ_WRITE; candidate++) {
+        if (name == copyMethodName((CopyMethod) candidate)) {
+            *method = (CopyMethod) candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool writeAll(int fd, const char *buf, size_t count) {
+    while (count > 0) {
+        auto writeRes = write(fd, buf, count);
+        if (writeRes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += writeRes;
+        count -= writeRes;
+    }
+    return true;
+}
+
+// The kernel refuses these methods for some file types and filesystem combinations, which is only
+// a reason to fall back when nothing was copied yet
+static bool isUnsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ENOTTY;
+}
+
+static int copyWithFileRange(int fdSource, int fdTarget, off_t *copied) {
+    while (true) {
+        auto res = copy_file_range(fdSource, nullptr, fdTarget, nullptr, COPY_CHUNK_SIZE, 0);
+        if (res == 0) {
+            return COPY_DONE;
+        } else if (res > 0) {
+            *copied += res;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (*copied == 0 && isUnsupported(errno)) {
+            return COPY_UNSUPPORTED;
+        } else {
+            logSysCallError("copy_file_range");
+            return COPY_FAILED;
+        }
+    }
+}
+
+static int copyWithSendfile(int fdSource, int fdTarget, off_t *copied) {
+    while (true) {
+        auto res = sendfile(fdTarget, fdSource, nullptr, COPY_CHUNK_SIZE);
+        if (res == 0) {
+            return COPY_DONE;
+        } else if (res > 0) {
+            *copied += res;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (*copied == 0 && isUnsupported(errno)) {
+            return COPY_UNSUPPORTED;
+        } else {
+            logSysCallError("sendfile");
+            return COPY_FAILED;
+        }
+    }
+}
+
+// A chunk of the file moving through one registered buffer: read fully, then written fully
+struct UringSlot {
+    off_t offset;
+    size_t length;
+    size_t filled;
+    size_t written;
+    bool isWriting;
+};
+
+static bool queueUringOp(IoUring &ring, int fd, char *buffers, unsigned slotIndex, const UringSlot &slot) {
+    auto sqe = ring.getSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    auto buf = buffers + (size_t) slotIndex * COPY_URING_BLOCK_SIZE;
+    sqe->opcode = slot.isWriting ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->buf_index = slotIndex;
+    sqe->user_data = slotIndex;
+    if (slot.isWriting) {
+        sqe->addr = (unsigned long) (buf + slot.written);
+        sqe->len = slot.filled - slot.written;
+        sqe->off = slot.offset + slot.written;
+    } else {
+        sqe->addr = (unsigned long) (buf + slot.filled);
+        sqe->len = slot.length - slot.filled;
+        sqe->off = slot.offset + slot.filled;
+    }
+    return true;
+}
+
+static int copyWithUring(int fdSource, int fdTarget, off_t *copied) {
+    struct stat st;
+    if (fstat(fdSource, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return COPY_UNSUPPORTED;
+    }
+    auto next = lseek(fdSource, 0, SEEK_CUR);
+    auto end = st.st_size;
+    // Small files do not get more buffers than they have blocks, pinning them is the main setup cost
+    auto blocks = (end - next + COPY_URING_BLOCK_SIZE - 1) / COPY_URING_BLOCK_SIZE;
+    auto depth = (unsigned) max((off_t) 1, min((off_t) copyUringDepth, blocks));
+
+    // Every slot has at most one operation in flight, so the ring never needs more than depth entries
+    IoUring ring;
+    if (!ring.init(depth)) {
+        return COPY_UNSUPPORTED;
+    }
+
+    void *mem;
+    if (posix_memalign(&mem, COPY_BUFFER_ALIGNMENT, (size_t) depth * COPY_URING_BLOCK_SIZE) != 0) {
+        logSysCallError("posix_memalign");
+        return COPY_FAILED;
+    }
+    auto buffers = (char *) mem;
+
+    vector<struct iovec> iovecs(depth);
+    for (unsigned i = 0; i < depth; i++) {
+        iovecs[i].iov_base = buffers + (size_t) i * COPY_URING_BLOCK_SIZE;
+        iovecs[i].iov_len = COPY_URING_BLOCK_SIZE;
+    }
+    if (!ring.registerBuffers(iovecs.data(), depth)) {
+        free(mem);
+        return COPY_UNSUPPORTED;
+    }
+
+    vector<UringSlot> slots(depth);
+    unsigned inFlight = 0;
+    auto result = COPY_DONE;
+
+    for (unsigned i = 0; i < depth && next < end; i++) {
+        slots[i] = UringSlot{next, (size_t) min((off_t) COPY_URING_BLOCK_SIZE, end - next), 0, 0, false};
+        next += slots[i].length;
+        queueUringOp(ring, fdSource, buffers, i, slots[i]);
+        inFlight++;
+    }
+
+    while (inFlight > 0) {
+        if (ring.submitAndWait(1) == -1) {
+            logSysCallError("io_uring_enter");
+            result = COPY_FAILED;
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring.peekCqe()) != nullptr) {
+            auto index = (unsigned) cqe->user_data;
+            auto res = cqe->res;
+            ring.seenCqe();
+            inFlight--;
+
+            auto &slot = slots[index];
+            if (res == -EINTR || res == -EAGAIN) {
+                // Retried as is
+            } else if (res < 0) {
+                if (*copied == 0 && isUnsupported(-res)) {
+                    result = COPY_UNSUPPORTED;
+                } else {
+                    errno = -res;
+                    logSysCallError(slot.isWriting ? "io_uring write" : "io_uring read");
+                    result = COPY_FAILED;
+                }
+                continue;
+            } else if (slot.isWriting) {
+                slot.written += res;
+                if (slot.written == slot.filled) {
+                    *copied += slot.filled;
+                    if (result != COPY_DONE || next >= end) {
+                        continue;
+                    }
+                    slot = UringSlot{next, (size_t) min((off_t) COPY_URING_BLOCK_SIZE, end - next), 0, 0, false};
+                    next += slot.length;
+                }
+            } else if (res == 0) {
+                // The source shrank, stop handing out chunks past this point
+                end = min(end, slot.offset + (off_t) slot.filled);
+                next = min(next, end);
+                slot.length = slot.filled;
+                slot.isWriting = slot.filled > 0;
+                if (!slot.isWriting) {
+                    continue;
+                }
+            } else {
+                slot.filled += res;
+                slot.isWriting = slot.filled == slot.length;
+            }
+
+            if (result == COPY_DONE) {
+                queueUringOp(ring, slot.isWriting ? fdTarget : fdSource, buffers, index, slot);
+                inFlight++;
+            }
+        }
+    }
+
+    // Nothing is in flight anymore, so the registered buffers can go
+    free(mem);
+
+    if (result == COPY_DONE) {
+        lseek(fdSource, *copied, SEEK_CUR);
+        lseek(fdTarget, *copied, SEEK_CUR);
+    }
+    return result;
+}
+
+static int copyWithReadWrite(int fdSource, int fdTarget, off_t *copied) {
+    void *buf;
+    if (posix_memalign(&buf, COPY_BUFFER_ALIGNMENT, COPY_BUFFER_SIZE) != 0) {
+        logSysCallError("posix_memalign");
+        return COPY_FAILED;
+    }
+
+    auto result = COPY_DONE;
+    while (true) {
+        auto readCount = read(fdSource, buf, COPY_BUFFER_SIZE);
+        if (readCount == 0) {
+            break;
+        } else if (readCount == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logSysCallError("read");
+            result = COPY_FAILED;
+            break;
+        }
+
+        if (!writeAll(fdTarget, (const char *) buf, readCount)) {
+            logSysCallError("write");
+            result = COPY_FAILED;
+            break;
+        }
+        *copied += readCount;
+    }
+
+    free(buf);
+    return result;
+}
+
+ssize_t copyFileContent(int fdSource, int fdTarget, CopyMethod *usedMethod) {
+    struct stat st;
+    if (fstat(fdSource, &st) == -1) {
+        logSysCallError("fstat");
+        return -1;
+    }
+    auto isRegular = S_ISREG(st.st_mode);
+
+    auto isAuto = copyEngine == COPY_AUTO || copyEngine == COPY_REFLINK;
+    if (isAuto && isRegular && ioctl(fdTarget, FICLONE, fdSource) == 0) {
+        *usedMethod = COPY_REFLINK;
+        return st.st_size;
+    }
+
+    // Reserving the whole target up front keeps it contiguous and fails early on a full disk
+    auto isPreallocated = false;
+    if (isRegular && st.st_size > 0) {
+        if (fallocate(fdTarget, 0, 0, st.st_size) == 0) {
+            isPreallocated = true;
+        } else if (errno == ENOSPC) {
+            logSysCallError("fallocate");
+            return -1;
+        }
+        posix_fadvise(fdSource, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    off_t copied = 0;
+    int (*const methods[])(int, int, off_t *) = {copyWithFileRange, copyWithSendfile, copyWithUring,
+                                                 copyWithReadWrite};
+    const CopyMethod methodIds[] = {COPY_FILE_RANGE, COPY_SENDFILE, COPY_URING, COPY_READ_WRITE};
+    size_t methodsCount = sizeof(methodIds) / sizeof(methodIds[0]);
+
+    // Pseudo files (procfs, sysfs) report a zero size and only hand out their content to read
+    size_t firstMethod = isRegular && st.st_size > 0 ? 0 : methodsCount - 1;
+    while (!isAuto && firstMethod < methodsCount - 1 && methodIds[firstMethod] < copyEngine) {
+        firstMethod++;
+    }
+
+    auto result = COPY_UNSUPPORTED;
+    for (auto i = firstMethod; i < methodsCount && result == COPY_UNSUPPORTED; i++) {
+        *usedMethod = methodIds[i];
+        result = methods[i](fdSource, fdTarget, &copied);
+    }
+
+    if (result == COPY_FAILED) {
+        return -1;
+    }
+
+    // The source may have shrunk since it was measured
+    if (isPreallocated && copied < st.st_size && ftruncate(fdTarget, copied) == -1) {
+        logSysCallError("ftruncate");
+        return -1;
+    }
+    return copied;
+}
+
+// Pool of copy workers, each owning a deque of tasks. A worker takes its own newest task first and
+// steals the oldest task of another worker when its deque runs dry, so a directory walk stays local
+// to the worker that found it while big subtrees and file ranges spread over idle workers.
+class CopyPool {
+public:
+    typedef function<void(size_t)> Task;
+
+    atomic<long> files;
+    atomic<long long> bytes;
+    atomic<bool> failed;
+
+    explicit CopyPool(int threads) : files(0), bytes(0), failed(false), workers(), idleLock(), idle(),
+                                     pending(0), queued(0) {
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(unique_ptr<Worker>(new Worker()));
+        }
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    void push(size_t worker, Task task) {
+        pending++;
+        {
+            lock_guard<mutex> lock(workers[worker]->lock);
+            workers[worker]->tasks.push_back(std::move(task));
+        }
+        queued++;
+        {
+            lock_guard<mutex> lock(idleLock);
+        }
+        idle.notify_one();
+    }
+
+    // Runs until every task, including the ones pushed by other tasks, is done
+    void run() {
+        vector<thread> threads;
+        for (size_t i = 1; i < workers.size(); i++) {
+            threads.push_back(thread(&CopyPool::work, this, i));
+        }
+        work(0);
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+private:
+    struct Worker {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    mutex idleLock;
+    condition_variable idle;
+    // Tasks pushed and not finished yet, and tasks waiting in a deque
+    atomic<long> pending;
+    atomic<long> queued;
+
+    bool pop(size_t self, Task &task) {
+        for (size_t i = 0; i < workers.size(); i++) {
+            auto &worker = *workers[(self + i) % workers.size()];
+            lock_guard<mutex> lock(worker.lock);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+
+            if (i == 0) {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            } else {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        Task task;
+        while (true) {
+            if (pop(self, task)) {
+                task(self);
+                // Drop what the task captured (open files) before it counts as done
+                task = nullptr;
+                if (--pending == 0) {
+                    lock_guard<mutex> lock(idleLock);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            unique_lock<mutex> lock(idleLock);
+            idle.wait(lock, [this] { return pending == 0 || queued > 0; });
+            if (pending == 0) {
+                return;
+            }
+        }
+    }
+};
+
+// A large file whose ranges are copied by several workers, closed once the last range is done
+struct SharedCopy {
+    CopyPool &pool;
+    int fdSource;
+    int fdTarget;
+
+    SharedCopy(CopyPool &pool, int fdSource, int fdTarget) : pool(pool), fdSource(fdSource), fdTarget(fdTarget) {}
+
+    ~SharedCopy() {
+        if (close(fdSource) == -1 || close(fdTarget) == -1) {
+            logSysCallError("close");
+            pool.failed = true;
+        } else {
+            pool.files++;
+        }
+    }
+};
+
+static void copyRange(SharedCopy &file, off_t offset, off_t length) {
+    loff_t offSource = offset;
+    loff_t offTarget = offset;
+    auto end = offset + length;
+
+    while (offSource < end) {
+        auto res = copy_file_range(file.fdSource, &offSource, file.fdTarget, &offTarget, end - offSource, 0);
+        if (res == 0) {
+            return;
+        } else if (res > 0) {
+            file.pool.bytes += res;
+            continue;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (offSource != offset || !isUnsupported(errno)) {
+            logSysCallError("copy_file_range");
+            file.pool.failed = true;
+            return;
+        }
+
+        // No in-kernel copy between these files, positional reads and writes work on any pair
+        void *buf;
+        if (posix_memalign(&buf, COPY_BUFFER_ALIGNMENT, COPY_BUFFER_SIZE) != 0) {
+            logSysCallError("posix_memalign");
+            file.pool.failed = true;
+            return;
+        }
+        while (offSource < end) {
+            auto readCount = pread(file.fdSource, buf, min((off_t) COPY_BUFFER_SIZE, end - offSource), offSource);
+            if (readCount == -1 && errno == EINTR) {
+                continue;
+            } else if (readCount <= 0) {
+                if (readCount == -1) {
+                    logSysCallError("pread");
+                    file.pool.failed = true;
+                }
+                break;
+            }
+
+            auto written = 0L;
+            while (written < readCount) {
+                auto writeRes = pwrite(file.fdTarget, (char *) buf + written, readCount - written,
+                                       offSource + written);
+                if (writeRes == -1 && errno != EINTR) {
+                    logSysCallError("pwrite");
+                    file.pool.failed = true;
+                    free(buf);
+                    return;
+                }
+                written += writeRes == -1 ? 0 : writeRes;
+            }
+            offSource += readCount;
+            file.pool.bytes += readCount;
+        }
+        free(buf);
+        return;
+    }
+}
+
+static void copyFileTask(CopyPool &pool, size_t worker, const string &source, const string &target,
+                         const struct stat &st) {
+    auto fdSource = open(source.c_str(), O_RDONLY);
+    if (fdSource == -1) {
+        logSysCallError("open");
+        pool.failed = true;
+        return;
+    }
+    // The target is truncated only after making sure it is not the source itself, which is left as it is
+    auto fdTarget = open(target.c_str(), O_WRONLY | O_CREAT, st.st_mode & 07777);
+    if (fdTarget == -1) {
+        logSysCallError("open");
+        close(fdSource);
+        pool.failed = true;
+        return;
+    }
+    struct stat targetStat;
+    if (fstat(fdTarget, &targetStat) == 0 && st.st_dev == targetStat.st_dev && st.st_ino == targetStat.st_ino) {
+        pool.files++;
+        close(fdSource);
+        close(fdTarget);
+        return;
+    }
+    if (ftruncate(fdTarget, 0) == -1) {
+        logSysCallError("ftruncate");
+        close(fdSource);
+        close(fdTarget);
+        pool.failed = true;
+        return;
+    }
+
+    if (pool.size() == 1 || st.st_size < COPY_PARALLEL_MIN_SIZE) {
+        CopyMethod method;
+        auto copied = copyFileContent(fdSource, fdTarget, &method);
+        if (copied == -1) {
+            pool.failed = true;
+        } else {
+            pool.bytes += copied;
+            pool.files++;
+        }
+        if (close(fdSource) == -1 || close(fdTarget) == -1) {
+            logSysCallError("close");
+            pool.failed = true;
+        }
+        return;
+    }
+
+    auto file = make_shared<SharedCopy>(pool, fdSource, fdTarget);
+
+    if (ioctl(fdTarget, FICLONE, fdSource) == 0) {
+        pool.bytes += st.st_size;
+        return;
+    }
+    if (fallocate(fdTarget, 0, 0, st.st_size) == -1 && errno == ENOSPC) {
+        logSysCallError("fallocate");
+        pool.failed = true;
+        return;
+    }
+
+    // Two ranges per worker leave room for stealing when some ranges are slower than others
+    auto rangeSize = max((off_t) COPY_RANGE_MIN_SIZE, st.st_size / (off_t) (pool.size() * 2) + 1);
+    for (auto offset = rangeSize; offset < st.st_size; offset += rangeSize) {
+        auto length = min(rangeSize, st.st_size - offset);
+        pool.push(worker, [file, offset, length](size_t) { copyRange(*file, offset, length); });
+    }
+    copyRange(*file, 0, min(rangeSize, st.st_size));
+}
+
+static void copyEntry(CopyPool &pool, size_t worker, const string &source, const string &target) {
+    struct stat st;
+    if (lstat(source.c_str(), &st) == -1) {
+        logSysCallError("lstat");
+        pool.failed = true;
+    } else if (S_ISREG(st.st_mode)) {
+        copyFileTask(pool, worker, source, target, st);
+    } else if (S_ISLNK(st.st_mode)) {
+        char link[PATH_MAX];
+        auto linkLength = readlink(source.c_str(), link, sizeof(link) - 1);
+        if (linkLength == -1) {
+            logSysCallError("readlink");
+            pool.failed = true;
+            return;
+        }
+        link[linkLength] = 0;
+        if (symlink(link, target.c_str()) == -1) {
+            logSysCallError("symlink");
+            pool.failed = true;
+            return;
+        }
+        pool.files++;
+    } else if (S_ISDIR(st.st_mode)) {
+        if (mkdir(target.c_str(), (st.st_mode & 07777) | S_IRWXU) == -1 && errno != EEXIST) {
+            logSysCallError("mkdir");
+            pool.failed = true;
+            return;
+        }
+        auto dir = opendir(source.c_str());
+        if (dir == nullptr) {
+            logSysCallError("opendir");
+            pool.failed = true;
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            string name = entry->d_name;
+            if (name == "." || name == "..") {
+                continue;
+            }
+            auto entrySource = source + "/" + name;
+            auto entryTarget = target + "/" + name;
+            pool.push(worker, [&pool, entrySource, entryTarget](size_t self) {
+                copyEntry(pool, self, entrySource, entryTarget);
+            });
+        }
+        closedir(dir);
+    } else {
+        logError("cp: skipping special file " + source);
+    }
+}
+
+// True when path is dir or lies below it, found by walking up from path through .. so symlinks cannot hide it
+static bool isInsideDir(const struct stat &dir, const string &path) {
+    auto current = path;
+    struct stat st, parentSt;
+    while (stat(current.c_str(), &st) == 0) {
+        if (st.st_dev == dir.st_dev && st.st_ino == dir.st_ino) {
+            return true;
+        }
+        auto parent = current + "/..";
+        if (stat(parent.c_str(), &parentSt) == -1 || (parentSt.st_dev == st.st_dev && parentSt.st_ino == st.st_ino)) {
+            return false;
+        }
+        current = parent;
+    }
+    return false;
+}
+
+bool copyParallel(const string &source, const string &target, bool isRecursive, int threads,
+                  CopyStats *stats) {
+    auto start = chrono::steady_clock::now();
+    stats->files = 0;
+    stats->bytes = 0;
+    stats->seconds = 0;
+
+    struct stat st;
+    if (stat(source.c_str(), &st) == -1) {
+        logSysCallError("stat");
+        return false;
+    }
+    if (S_ISDIR(st.st_mode) && !isRecursive) {
+        logError("cp: -r not specified; omitting directory " + source);
+        return false;
+    }
+
+    auto destination = target;
+    struct stat targetStat;
+    if (S_ISDIR(st.st_mode) && stat(target.c_str(), &targetStat) == 0 && S_ISDIR(targetStat.st_mode)) {
+        auto trimmed = source.substr(0, source.find_last_not_of('/') + 1);
+        destination = target + "/" + trimmed.substr(trimmed.find_last_of('/') + 1);
+    }
+
+    // The copy would keep walking into itself, the destination may not exist yet so its directory is checked
+    auto slash = destination.find_last_of('/');
+    auto destinationDir = slash == string::npos ? "." : slash == 0 ? "/" : destination.substr(0, slash);
+    if (S_ISDIR(st.st_mode) && (isInsideDir(st, destination) || isInsideDir(st, destinationDir))) {
+        logError("cp: cannot copy a directory, " + source + ", into itself, " + destination);
+        return false;
+    }
+
+    CopyPool pool(max(threads, 1));
+    pool.push(0, [&pool, &source, &destination](size_t self) {
+        copyEntry(pool, self, source, destination);
+    });
+    pool.run();
+
+    stats->files = pool.files;
+    stats->bytes = pool.bytes;
+    stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return !pool.failed;
+}
+
+// Moves exactly count bytes from the pipe fdSource to fdTarget
+static bool spliceAll(int fdSource, int fdTarget, size_t count) {
+    while (count > 0) {
+        auto res = splice(fdSource, nullptr, fdTarget, nullptr, count, SPLICE_F_MOVE);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        } else if (res <= 0) {
+            return false;
+        }
+        count -= res;
+    }
+    return true;
+}
+
+static bool relayWithReadWrite(int fdSource, const vector<int> &fdTargets) {
+    vector<char> buf(COPY_BUFFER_SIZE);
+    while (true) {
+        auto readCount = read(fdSource, buf.data(), buf.size());
+        if (readCount == 0) {
+            return true;
+        } else if (readCount == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logSysCallError("read");
+            return false;
+        }
+        for (auto fd : fdTargets) {
+            if (!writeAll(fd, buf.data(), readCount)) {
+                logSysCallError("write");
+                return false;
+            }
+        }
+    }
+}
+
+// splice(2) needs a pipe on one side and refuses terminals and append-only files on the other
+static bool canSpliceTo(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !(S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))) {
+        return false;
+    }
+    auto flags = fcntl(fd, F_GETFL);
+    return flags != -1 && (flags & O_APPEND) == 0;
+}
+
+bool relayData(int fdSource, const vector<int> &fdTargets, size_t pipeSize) {
+    struct stat st;
+    auto isZeroCopy = !fdTargets.empty() && fstat(fdSource, &st) == 0 && S_ISFIFO(st.st_mode);
+    for (size_t i = 0; i < fdTargets.size() && isZeroCopy; i++) {
+        isZeroCopy = canSpliceTo(fdTargets[i]);
+    }
+    if (!isZeroCopy) {
+        return relayWithReadWrite(fdSource, fdTargets);
+    }
+
+    // Private pipes start every chunk empty and equally sized, so tee(2) duplicates the same amount
+    // into each of them
+    vector<int> teePipes;
+    auto isOk = true;
+    for (size_t i = 0; i + 1 < fdTargets.size(); i++) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            logSysCallError("pipe");
+            isOk = false;
+            break;
+        }
+        teePipes.push_back(fds[0]);
+        teePipes.push_back(fds[1]);
+        if (pipeSize > 0 && fcntl(fds[1], F_SETPIPE_SZ, (int) pipeSize) == -1) {
+            logSysCallError("fcntl");
+        }
+    }
+    auto chunk = teePipes.empty() ? (size_t) COPY_CHUNK_SIZE : (size_t) fcntl(teePipes[1], F_GETPIPE_SZ);
+
+    while (isOk) {
+        // The first tee decides how much this chunk holds, the other copies must match it
+        ssize_t count = -1;
+        for (size_t i = 0; i < teePipes.size() && isOk; i += 2) {
+            ssize_t res;
+            do {
+                res = tee(fdSource, teePipes[i + 1], count == -1 ? chunk : (size_t) count, 0);
+            } while (res == -1 && errno == EINTR);
+
+            if (res == -1 || (count != -1 && res != count)) {
+                logSysCallError("tee");
+                isOk = false;
+            }
+            count = res;
+        }
+        if (!isOk || count == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < teePipes.size() && isOk; i += 2) {
+            if (!spliceAll(teePipes[i], fdTargets[i / 2], count)) {
+                logSysCallError("splice");
+                isOk = false;
+            }
+        }
+        if (!isOk) {
+            break;
+        }
+
+        // The last target consumes the chunk from fdSource itself
+        if (count != -1) {
+            if (!spliceAll(fdSource, fdTargets.back(), count)) {
+                logSysCallError("splice");
+                isOk = false;
+            }
+            continue;
+        }
+
+        auto res = splice(fdSource, nullptr, fdTargets.back(), nullptr, chunk, SPLICE_F_MOVE);
+        if (res == 0) {
+            break;
+        } else if (res == -1 && errno != EINTR) {
+            logSysCallError("splice");
+            isOk = false;
+        }
+    }
+
+    for (auto fd : teePipes) {
+        close(fd);
+    }
+    return isOk;
+}
@@ -0,0 +1,65 @@
+#ifndef SMASH_COPY_H_
+#define SMASH_COPY_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#define COPY_BUFFER_SIZE (1 << 20)
+#define COPY_BUFFER_ALIGNMENT (4096)
+// Upper bound of a single copy_file_range/sendfile request
+#define COPY_CHUNK_SIZE (1 << 30)
+// Files at least this big are split into ranges copied by several workers
+#define COPY_PARALLEL_MIN_SIZE (64 << 20)
+#define COPY_RANGE_MIN_SIZE (16 << 20)
+
+// io_uring engine: every in-flight read or write owns one registered buffer of this size
+#define COPY_URING_BLOCK_SIZE (1 << 20)
+#define COPY_URING_DEFAULT_DEPTH (8)
+
+// Ordered from cheapest to most expensive, copyFileContent falls back along this order
+enum CopyMethod {
+    COPY_AUTO,       // not a method, start from the cheapest one
+    COPY_REFLINK,    // FICLONE, the target shares the source extents
+    COPY_FILE_RANGE, // in-kernel copy, may be offloaded by the filesystem
+    COPY_SENDFILE,   // in-kernel copy through the page cache
+    COPY_URING,      // batched, overlapping reads and writes through io_uring with registered buffers
+    COPY_READ_WRITE  // userspace copy through a large aligned buffer
+};
+
+// First method copyFileContent tries (set copyengine=...), and the io_uring queue depth (set uringdepth=...)
+extern CopyMethod copyEngine;
+extern unsigned copyUringDepth;
+
+const char *copyMethodName(CopyMethod method);
+
+// Returns false if name is not one of the names returned by copyMethodName
+bool parseCopyMethod(const std::string &name, CopyMethod *method);
+
+// Writes the whole buffer, retrying short writes, returns false on failure (errno is set)
+bool writeAll(int fd, const char *buf, size_t count);
+
+// Copies everything from fdSource's offset to fdTarget's offset, starting with copyEngine and falling back to the next one when the filesystem or file type does not support it.
+// Returns the number of bytes copied or -1 after logging the failed syscall.
+ssize_t copyFileContent(int fdSource, int fdTarget, CopyMethod *usedMethod);
+
+struct CopyStats {
+    long files;
+    long long bytes;
+    double seconds;
+};
+
+// Copies source to target with a pool of work-stealing threads. With isRecursive a directory tree is
+// walked by the workers themselves, and copied into target/<source name> when target is an existing
+// directory. Returns false if anything failed (already logged), stats are filled in either way.
+bool copyParallel(const std::string &source, const std::string &target, bool isRecursive, int threads,
+                  CopyStats *stats);
+
+// Copies everything from fdSource to every fd in fdTargets until end of input. When fdSource is a pipe the
+// data never enters userspace: tee(2) duplicates each chunk into private pipes (pipeSize bytes, 0 for the
+// kernel default) that are spliced to all targets but the last, and the chunk is then spliced from
+// fdSource to the last target. Anything else goes through a read/write loop.
+// Returns false after logging the failed syscall.
+bool relayData(int fdSource, const std::vector<int> &fdTargets, size_t pipeSize);
+
+#endif //SMASH_COPY_H_
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "copy.h"
+#include "utils.h"
+
+using namespace std;
+
+// Bigrams and trigrams share the buckets, a bigram key has bit 24 set so it never equals a trigram key
+static inline uint32_t gramBucket(const char *s, size_t size) {
+    auto key = size == 3 ? (uint32_t) (unsigned char) s[0] << 16 | (uint32_t) (unsigned char) s[1] << 8 |
+                           (unsigned char) s[2]
+                         : 1u << 24 | (uint32_t) (unsigned char) s[0] << 8 | (unsigned char) s[1];
+    return (key * 2654435761u) >> 16;
+}
+
+// FNV-1a
+static inline uint32_t hashLine(const char *line, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char) line[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool HistoryFile::open(const string &filePath, size_t maxFileEntries) {
+    path = filePath;
+    maxEntries = maxFileEntries;
+    if (!reopen()) {
+        return false;
+    }
+
+    if (entries > maxEntries + maxEntries / 2) {
+        compact();
+    }
+    return true;
+}
+
+void HistoryFile::closeFile() {
+    if (mapped != nullptr) {
+        munmap((void *) mapped, mappedSize);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    mapped = nullptr;
+    mappedSize = 0;
+    fd = -1;
+}
+
+bool HistoryFile::reopen() {
+    closeFile();
+    indexedSize = 0;
+    indexedEntries = 0;
+    text.clear();
+    lineStart.clear();
+    lineHash.clear();
+    lastEntry.clear();
+    lineTable.clear();
+    grams.clear();
+    entries = 0;
+    countedSize = 0;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        logSysCallError("open");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        logSysCallError("fstat");
+        closeFile();
+        return false;
+    }
+    device = st.st_dev;
+    inode = st.st_ino;
+
+    if (!mapFile()) {
+        closeFile();
+        return false;
+    }
+    count();
+    return true;
+}
+
+bool HistoryFile::isCurrent() const {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && st.st_dev == device && st.st_ino == inode;
+}
+
+// Remaps the file when it grew, the file only ever grows until it is replaced
+bool HistoryFile::mapFile() {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        logSysCallError("fstat");
+        return false;
+    }
+
+    auto size = (size_t) st.st_size;
+    if (size == mappedSize) {
+        return true;
+    }
+
+    auto data = mapped == nullptr ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                                  : mremap((void *) mapped, mappedSize, size, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED) {
+        logSysCallError(mapped == nullptr ? "mmap" : "mremap");
+        return false;
+    }
+    mapped = (const char *) data;
+    mappedSize = size;
+    return true;
+}
+
+// Counts the records appended since the last count, by this shell or any other
+void HistoryFile::count() {
+    if (mapFile()) {
+        countedSize = walkRecords(countedSize, mappedSize, [this](size_t, const char *, size_t) { entries++; });
+    }
+}
+
+template<typename Callback>
+size_t HistoryFile::walkRecords(size_t offset, size_t end, Callback onRecord) const {
+    HistoryRecordHeader header;
+
+    while (offset + sizeof(header) <= end) {
+        memcpy(&header, mapped + offset, sizeof(header));
+        if (header.magic != HISTORY_RECORD_MAGIC) {
+            // Left by a failed write, resynchronize on the next record
+            offset++;
+            continue;
+        }
+        if (offset + sizeof(header) + header.size > end) {
+            // Still being written by another shell
+            break;
+        }
+
+        onRecord(offset, mapped + offset + sizeof(header), header.size);
+        offset += sizeof(header) + header.size;
+    }
+    return offset;
+}
+
+void HistoryFile::append(const string &cmdLine) {
+    if (fd == -1 || cmdLine.empty() || cmdLine.size() > HISTORY_MAX_LINE) {
+        return;
+    }
+
+    HistoryRecordHeader header = {HISTORY_RECORD_MAGIC, (uint16_t) cmdLine.size(), (uint32_t) getCurrentTime()};
+    record.assign((const char *) &header, sizeof(header));
+    record += cmdLine;
+
+    while (true) {
+        if (flock(fd, LOCK_SH) == -1) {
+            logSysCallError("flock");
+            return;
+        }
+        if (isCurrent()) {
+            break;
+        }
+        // Another shell compacted the file and renamed the new one over the path
+        flock(fd, LOCK_UN);
+        if (!reopen()) {
+            return;
+        }
+    }
+
+    if (!writeAll(fd, record.data(), record.size())) {
+        logSysCallError("write");
+    }
+    flock(fd, LOCK_UN);
+
+    count();
+    if (entries > maxEntries + maxEntries / 2) {
+        compact();
+    }
+}
+
+void HistoryFile::compact() {
+    if (flock(fd, LOCK_EX) == -1) {
+        logSysCallError("flock");
+        return;
+    }
+    if (!isCurrent() || !mapFile()) {
+        flock(fd, LOCK_UN);
+        reopen();
+        return;
+    }
+
+    size_t total = 0;
+    walkRecords(0, mappedSize, [&total](size_t, const char *, size_t) { total++; });
+
+    // Records are contiguous, so the newest maxEntries are the tail starting at record total - maxEntries
+    auto keepFrom = (size_t) 0;
+    auto skipped = (size_t) 0;
+    auto toSkip = total > maxEntries ? total - maxEntries : 0;
+    walkRecords(0, mappedSize, [&](size_t offset, const char *, size_t) {
+        if (skipped++ == toSkip) {
+            keepFrom = offset;
+        }
+    });
+    if (toSkip == total) {
+        keepFrom = mappedSize;
+    }
+
+    auto tmpPath = path + ".XXXXXX";
+    auto tmpFd = mkostemp(&tmpPath[0], O_CLOEXEC);
+    if (tmpFd == -1) {
+        logSysCallError("mkstemp");
+        flock(fd, LOCK_UN);
+        return;
+    }
+
+    auto isWritten = writeAll(tmpFd, mapped + keepFrom, mappedSize - keepFrom);
+    if (!isWritten) {
+        logSysCallError("write");
+    }
+    close(tmpFd);
+
+    if (!isWritten || rename(tmpPath.c_str(), path.c_str()) == -1) {
+        if (isWritten) {
+            logSysCallError("rename");
+        }
+        unlink(tmpPath.c_str());
+        flock(fd, LOCK_UN);
+        return;
+    }
+
+    flock(fd, LOCK_UN);
+    reopen();
+}
+
+void HistoryFile::growLineTable() {
+    lineTable.assign(max(lineTable.size() * 2, (size_t) 1024), 0);
+    auto mask = lineTable.size() - 1;
+    for (uint32_t id = 0; id < lineHash.size(); id++) {
+        auto slot = lineHash[id] & mask;
+        while (lineTable[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        lineTable[slot] = id + 1;
+    }
+}
+
+uint32_t HistoryFile::lineId(const char *line, size_t size) {
+    if ((lineHash.size() + 1) * 2 > lineTable.size()) {
+        growLineTable();
+    }
+
+    auto hash = hashLine(line, size);
+    auto mask = lineTable.size() - 1;
+    auto slot = hash & mask;
+    for (; lineTable[slot] != 0; slot = (slot + 1) & mask) {
+        auto id = lineTable[slot] - 1;
+        if (lineHash[id] == hash && lineSize(id) == size && memcmp(&text[lineStart[id]], line, size) == 0) {
+            return id;
+        }
+    }
+
+    uint32_t id = lineHash.size();
+    lineTable[slot] = id + 1;
+    lineHash.push_back(hash);
+    lineStart.push_back(text.size());
+    lastEntry.push_back(0);
+    text.append(line, size);
+    text += '\n';
+
+    for (size_t i = 0; i + 2 <= size; i++) {
+        for (size_t gram = 2; gram <= 3 && i + gram <= size; gram++) {
+            // Ids are added in ascending order, so a bucket already holding this line has it last
+            auto &posting = grams[gramBucket(line + i, gram)];
+            if (posting.empty() || posting.back() != id) {
+                posting.push_back(id);
+            }
+        }
+    }
+    return id;
+}
+
+void HistoryFile::index() {
+    if (grams.empty()) {
+        grams.resize(HISTORY_GRAM_BUCKETS);
+    }
+
+    indexedSize = walkRecords(indexedSize, mappedSize, [this](size_t, const char *line, size_t size) {
+        lastEntry[lineId(line, size)] = ++indexedEntries;
+    });
+}
+
+void HistoryFile::search(const string &pattern, vector<HistoryMatch> *matches) {
+    matches->clear();
+    if (fd == -1 || (!isCurrent() && !reopen()) || !mapFile()) {
+        return;
+    }
+    index();
+
+    // Entries up to first are beyond the configured size and wait for the next compaction
+    auto first = indexedEntries > maxEntries ? indexedEntries - maxEntries : 0;
+    auto addMatch = [&](uint32_t id) {
+        if (lastEntry[id] > first) {
+            matches->push_back({lastEntry[id], &text[lineStart[id]], lineSize(id)});
+        }
+    };
+
+    auto data = text.data();
+    if (pattern.size() < 2) {
+        // Lines are separated by newlines, which a pattern never contains, so a match never spans two lines
+        auto end = data + text.size();
+        for (auto at = data; at < end;) {
+            at = (const char *) memmem(at, end - at, pattern.data(), pattern.size());
+            if (at == nullptr) {
+                break;
+            }
+            uint32_t id = upper_bound(lineStart.begin(), lineStart.end(), at - data) - lineStart.begin() - 1;
+            addMatch(id);
+            at = data + lineStart[id] + lineSize(id) + 1;
+        }
+    } else {
+        // Only lines containing every trigram of the pattern (its bigram when that is all it has) can match,
+        // the smallest bucket has the fewest
+        auto gram = min(pattern.size(), (size_t) 3);
+        const vector<uint32_t> *rarest = nullptr;
+        for (size_t i = 0; i + gram <= pattern.size(); i++) {
+            auto &posting = grams[gramBucket(&pattern[i], gram)];
+            if (rarest == nullptr || posting.size() < rarest->size()) {
+                rarest = &posting;
+            }
+        }
+        for (auto id : *rarest) {
+            if (memmem(data + lineStart[id], lineSize(id), pattern.data(), pattern.size()) != nullptr) {
+                addMatch(id);
+            }
+        }
+    }
+
+    sort(matches->begin(), matches->end());
+}
@@ -0,0 +1,130 @@
+#ifndef SMASH_HISTORY_H_
+#define SMASH_HISTORY_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#define HISTORY_FILE_NAME ".smash_history"
+#define HISTORY_DEFAULT_SIZE (100000)
+// Longer lines stay in the session history only
+#define HISTORY_MAX_LINE (0xffff)
+#define HISTORY_RECORD_MAGIC (0x4853)
+#define HISTORY_GRAM_BUCKETS (1 << 16)
+
+// Every record is this header followed by size bytes of command line, without a terminator
+struct HistoryRecordHeader {
+    uint16_t magic;
+    uint16_t size;
+    uint32_t time;
+};
+
+// A line found by HistoryFile::search and the number of its latest entry
+struct HistoryMatch {
+    uint32_t entry;
+    const char *line;
+    uint32_t size;
+
+    bool operator<(const HistoryMatch &other) const {
+        return entry < other.entry;
+    }
+};
+
+// Command lines persisted in an append-only file shared by every smash using the same path. Each line is
+// one O_APPEND write, so concurrent shells never interleave records. Appenders hold a shared flock and
+// compaction an exclusive one; compaction writes the newest maxEntries records to a new file and renames it
+// over the old one, and a shell that finds the path pointing to another inode reopens it.
+//
+// The file is mapped read-only and indexed lazily by search: distinct lines get ids, and every trigram and
+// bigram maps to the ascending ids of the lines containing it, so a search verifies only the lines sharing
+// its rarest trigram. Single characters are found by scanning the distinct lines.
+class HistoryFile {
+    std::string path;
+    int fd;
+    dev_t device;
+    ino_t inode;
+    const char *mapped;
+    size_t mappedSize;
+    size_t maxEntries;
+    // Records in the file before countedSize
+    size_t entries;
+    size_t countedSize;
+    std::string record;
+
+    // Everything before indexedSize is in the index, indexedEntries is the number of the last entry there
+    size_t indexedSize;
+    uint32_t indexedEntries;
+    // Distinct lines one after the other, each followed by a newline, with where each starts, its hash and its
+    // latest entry, all by line id
+    std::string text;
+    std::vector<uint32_t> lineStart;
+    std::vector<uint32_t> lineHash;
+    std::vector<uint32_t> lastEntry;
+    // Open addressing table of line ids + 1, 0 is a free slot
+    std::vector<uint32_t> lineTable;
+    // Ascending ids of the lines containing a bigram or trigram, by a hash of it. Lines sharing a bucket only
+    // through another gram are filtered out when matching.
+    std::vector<std::vector<uint32_t>> grams;
+
+    bool reopen();
+
+    void closeFile();
+
+    bool isCurrent() const;
+
+    bool mapFile();
+
+    void count();
+
+    // Calls onRecord(offset, line, size) for every record in [offset, end), skipping bytes that are not one.
+    // Returns where it stopped, which is before a record still being written.
+    template<typename Callback>
+    size_t walkRecords(size_t offset, size_t end, Callback onRecord) const;
+
+    void compact();
+
+    void index();
+
+    uint32_t lineSize(uint32_t id) const {
+        return (id + 1 < lineStart.size() ? lineStart[id + 1] : text.size()) - lineStart[id] - 1;
+    }
+
+    // Returns the id of the line, adding it to the index if it is new
+    uint32_t lineId(const char *line, size_t size);
+
+    void growLineTable();
+
+public:
+    HistoryFile() : path(), fd(-1), device(0), inode(0), mapped(nullptr), mappedSize(0),
+                    maxEntries(HISTORY_DEFAULT_SIZE), entries(0), countedSize(0), record(), indexedSize(0), indexedEntries(0),
+                    text(), lineStart(), lineHash(), lastEntry(), lineTable(), grams() {}
+
+    ~HistoryFile() {
+        closeFile();
+    }
+
+    HistoryFile(HistoryFile const &) = delete;
+
+    void operator=(HistoryFile const &) = delete;
+
+    // Opens (creating it if needed) and maps the file, compacting it when it is well over maxEntries.
+    // Returns false after logging the failed syscall.
+    bool open(const std::string &filePath, size_t maxFileEntries);
+
+    void append(const std::string &cmdLine);
+
+    // Distinct lines among the newest maxEntries that contain pattern, oldest first. The lines stay valid
+    // until the next search.
+    void search(const std::string &pattern, std::vector<HistoryMatch> *matches);
+
+    void setMaxEntries(size_t maxFileEntries) {
+        maxEntries = maxFileEntries;
+    }
+
+    size_t size() const {
+        return entries;
+    }
+};
+
+#endif //SMASH_HISTORY_H_
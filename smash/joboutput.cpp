@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include "joboutput.h"
+#include "utils.h"
+
+using namespace std;
+
+bool CaptureScope::apply(int fd) {
+    // Whatever smash printed so far belongs to the terminal
+    cout << flush;
+    for (int i = 0; i < 2; i++) {
+        savedFds[i] = fcntl(i + 1, F_DUPFD_CLOEXEC, 3);
+        if (savedFds[i] == -1 || dup2(fd, i + 1) == -1) {
+            logSysCallError("dup2");
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+CaptureScope::~CaptureScope() {
+    cout << flush;
+    for (int i = 0; i < 2; i++) {
+        if (savedFds[i] != -1 && (dup2(savedFds[i], i + 1) == -1 || close(savedFds[i]) == -1)) {
+            logSysCallError("dup2");
+        }
+    }
+}
+
+JobOutputs::~JobOutputs() {
+    if (getpid() != ownerPid) {
+        return;
+    }
+    for (auto &it : byJob) {
+        release(&it.second);
+    }
+    if (epollFd != -1) {
+        close(epollFd);
+    }
+}
+
+bool JobOutputs::open(CaptureScope *scope, JobOutput *output) {
+    if (mode == CAPTURE_TTY) {
+        return true;
+    }
+
+    int fd;
+    output->sequence = ++sequence;
+    if (mode == CAPTURE_FILE) {
+        auto tmpDir = getenv("TMPDIR");
+        output->path = string(tmpDir != nullptr && tmpDir[0] != '\0' ? tmpDir : "/tmp") + "/smash-" +
+                       to_string(getpid()) + "-" + to_string(output->sequence) + ".log";
+        fd = ::open(output->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            logSysCallError("open");
+            output->path.clear();
+            return false;
+        }
+    } else {
+        int pipeFds[2];
+        if (epollFd == -1 && (epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+            logSysCallError("epoll_create1");
+            return false;
+        }
+        if (pipe2(pipeFds, O_CLOEXEC) == -1) {
+            logSysCallError("pipe");
+            return false;
+        }
+        // Only smash's end, the job blocks on a full pipe like it would on a slow terminal
+        if (fcntl(pipeFds[0], F_SETFL, O_NONBLOCK) == -1) {
+            logSysCallError("fcntl");
+        }
+        output->fd = pipeFds[0];
+        fd = pipeFds[1];
+    }
+
+    if (!scope->apply(fd)) {
+        discard(output);
+        return false;
+    }
+    return true;
+}
+
+void JobOutputs::attach(int jobId, JobOutput *output) {
+    if (output->fd == -1 && output->path.empty()) {
+        return;
+    }
+
+    auto it = byJob.find(jobId);
+    if (it != byJob.end()) {
+        release(&it->second);
+        byJob.erase(it);
+    }
+
+    auto &kept = byJob[jobId];
+    kept = std::move(*output);
+    if (kept.fd != -1) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = kept.fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, kept.fd, &event) == -1) {
+            logSysCallError("epoll_ctl");
+            close(kept.fd);
+            kept.fd = -1;
+        } else {
+            byFd[kept.fd] = jobId;
+        }
+    }
+}
+
+void JobOutputs::discard(JobOutput *output) {
+    if (output->fd != -1) {
+        close(output->fd);
+        output->fd = -1;
+    }
+    if (!output->path.empty()) {
+        unlink(output->path.c_str());
+        output->path.clear();
+    }
+}
+
+void JobOutputs::release(JobOutput *output) {
+    if (output->fd != -1) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, output->fd, nullptr);
+        byFd.erase(output->fd);
+    }
+    usedMemory -= output->ring.size();
+    discard(output);
+}
+
+bool JobOutputs::evictFinished(const JobOutput *keep) {
+    auto oldest = byJob.end();
+    for (auto it = byJob.begin(); it != byJob.end(); ++it) {
+        auto &output = it->second;
+        if (&output != keep && output.fd == -1 && !output.ring.empty() &&
+            (oldest == byJob.end() || output.sequence < oldest->second.sequence)) {
+            oldest = it;
+        }
+    }
+    if (oldest == byJob.end()) {
+        return false;
+    }
+    release(&oldest->second);
+    byJob.erase(oldest);
+    return true;
+}
+
+void JobOutputs::append(JobOutput *output, const char *data, size_t count) {
+    output->totalBytes += count;
+
+    auto &ring = output->ring;
+    while (ring.size() < ringSize && output->size + count > ring.size()) {
+        auto grown = min(ringSize, max((size_t) JOB_OUTPUT_MIN_RING, 2 * ring.size()));
+        auto othersMemory = usedMemory - ring.size();
+        auto room = othersMemory >= maxMemory ? 0 : maxMemory - othersMemory;
+        if (grown > room && evictFinished(output)) {
+            continue;
+        }
+        // Without a finished log to free, the job keeps the tail that fits in what is left
+        grown = min(grown, room);
+        if (grown <= ring.size()) {
+            break;
+        }
+
+        vector<char> grownRing(grown);
+        auto firstPart = min(output->size, ring.size() - output->start);
+        memcpy(grownRing.data(), ring.data() + output->start, firstPart);
+        memcpy(grownRing.data() + firstPart, ring.data(), output->size - firstPart);
+        usedMemory += grown - ring.size();
+        ring.swap(grownRing);
+        output->start = 0;
+    }
+
+    auto capacity = ring.size();
+    if (capacity == 0) {
+        return;
+    }
+    if (count > capacity) {
+        data += count - capacity;
+        count = capacity;
+    }
+
+    auto end = (output->start + output->size) % capacity;
+    auto firstPart = min(count, capacity - end);
+    memcpy(ring.data() + end, data, firstPart);
+    memcpy(ring.data(), data + firstPart, count - firstPart);
+
+    // The new bytes overwrite the oldest ones once the ring is full
+    if (output->size + count > capacity) {
+        output->start = (output->start + output->size + count - capacity) % capacity;
+        output->size = capacity;
+    } else {
+        output->size += count;
+    }
+}
+
+void JobOutputs::drain() {
+    if (epollFd == -1) {
+        return;
+    }
+
+    static char buf[64 << 10];
+    struct epoll_event events[JOB_OUTPUT_EVENTS];
+    auto eventsCount = epoll_wait(epollFd, events, JOB_OUTPUT_EVENTS, 0);
+
+    // One read per ready pipe, level-triggered epoll reports the ones that still hold more next time
+    for (int i = 0; i < eventsCount; i++) {
+        auto fd = events[i].data.fd;
+        auto it = byFd.find(fd);
+        if (it == byFd.end()) {
+            continue;
+        }
+        auto &output = byJob[it->second];
+
+        auto readCount = read(fd, buf, sizeof(buf));
+        if (readCount > 0) {
+            append(&output, buf, readCount);
+        } else if (readCount == 0 || (errno != EAGAIN && errno != EINTR)) {
+            // Every process of the job closed its end, the log is complete
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            byFd.erase(it);
+            close(fd);
+            output.fd = -1;
+        }
+    }
+}
+
+const JobOutput *JobOutputs::getOutput(int jobId) const {
+    auto it = byJob.find(jobId);
+    return it == byJob.end() ? nullptr : &it->second;
+}
+
+bool JobOutputs::printTail(int jobId) {
+    drain();
+    auto it = byJob.find(jobId);
+    if (it == byJob.end()) {
+        return false;
+    }
+    auto &output = it->second;
+
+    if (output.path.empty()) {
+        auto firstPart = min(output.size, output.ring.size() - output.start);
+        cout.write(output.ring.data() + output.start, firstPart);
+        cout.write(output.ring.data(), output.size - firstPart);
+        cout << flush;
+        return true;
+    }
+
+    // A spill file holds everything, the tail is as long as a ring would keep
+    auto fd = ::open(output.path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        logSysCallError("open");
+        if (fd != -1) {
+            close(fd);
+        }
+        return true;
+    }
+    vector<char> tail(min((size_t) st.st_size, ringSize));
+    auto readCount = pread(fd, tail.data(), tail.size(), st.st_size - tail.size());
+    if (readCount == -1) {
+        logSysCallError("read");
+    }
+    cout.write(tail.data(), max(readCount, (ssize_t) 0)) << flush;
+    close(fd);
+    return true;
+}
@@ -0,0 +1,139 @@
+#ifndef SMASH_JOBOUTPUT_H_
+#define SMASH_JOBOUTPUT_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#define JOB_OUTPUT_RING_SIZE (64 << 10)
+#define JOB_OUTPUT_MAX_MEMORY (8 << 20)
+// Rings start this small and double as output arrives, most jobs print a few lines
+#define JOB_OUTPUT_MIN_RING (4 << 10)
+#define JOB_OUTPUT_EVENTS (64)
+
+enum CaptureMode {
+    CAPTURE_TTY,  // background jobs write to smash's stdout and stderr
+    CAPTURE_RING, // into a pipe drained by smash, keeping the tail in memory
+    CAPTURE_FILE  // straight into a file of their own, smash keeps no copy
+};
+
+// The captured stdout and stderr of a background job, kept after the job is gone until its id is reused
+struct JobOutput {
+    // Read end of the job's pipe, -1 at EOF
+    int fd;
+    // The spill file under CAPTURE_FILE
+    std::string path;
+    // Holds the last ring.size() bytes, oldest at start
+    std::vector<char> ring;
+    size_t start;
+    size_t size;
+    long long totalBytes;
+    // Evicted logs go oldest first
+    unsigned long sequence;
+
+    JobOutput() : fd(-1), path(), ring(), start(0), size(0), totalBytes(0), sequence(0) {}
+};
+
+// Points smash's stdout and stderr at a job's capture until it goes out of scope. Whatever starts the job
+// meanwhile (posix_spawn, fork) inherits them, so no spawn path needs to know about capturing.
+class CaptureScope {
+    int savedFds[2];
+public:
+    CaptureScope() : savedFds{-1, -1} {}
+
+    ~CaptureScope();
+
+    CaptureScope(CaptureScope const &) = delete;
+
+    void operator=(CaptureScope const &) = delete;
+
+    // Takes fd over, returns false after logging the failed syscall
+    bool apply(int fd);
+};
+
+// The logs of every captured job. One epoll instance watches all of their pipes, so the main loop and the
+// foreground wait add a single fd to their poll however many jobs are running. Rings grow on demand and their
+// total stays under the memory limit, logs of finished jobs giving way first.
+class JobOutputs {
+    CaptureMode mode;
+    size_t ringSize;
+    size_t maxMemory;
+    size_t usedMemory;
+    int epollFd;
+    unsigned long sequence;
+    // Forked children destroy their copy on exit as well, the spill files are only removed by smash
+    pid_t ownerPid;
+    std::unordered_map<int, JobOutput> byJob;
+    // Job id of each pipe being drained
+    std::unordered_map<int, int> byFd;
+
+    void append(JobOutput *output, const char *data, size_t count);
+
+    // Frees the oldest log whose job wrote its last byte, other than keep. Returns false when there is none.
+    bool evictFinished(const JobOutput *keep);
+
+    void release(JobOutput *output);
+public:
+    JobOutputs() : mode(CAPTURE_TTY), ringSize(JOB_OUTPUT_RING_SIZE), maxMemory(JOB_OUTPUT_MAX_MEMORY),
+                   usedMemory(0), epollFd(-1), sequence(0), ownerPid(getpid()), byJob(), byFd() {}
+
+    // Removes the spill files of every log left
+    ~JobOutputs();
+
+    JobOutputs(JobOutputs const &) = delete;
+
+    void operator=(JobOutputs const &) = delete;
+
+    CaptureMode getMode() const {
+        return mode;
+    }
+
+    void setMode(CaptureMode newMode) {
+        mode = newMode;
+    }
+
+    size_t getRingSize() const {
+        return ringSize;
+    }
+
+    // Applies to rings that grow from now on
+    void setRingSize(size_t size) {
+        ringSize = size;
+    }
+
+    size_t getMaxMemory() const {
+        return maxMemory;
+    }
+
+    void setMaxMemory(size_t size) {
+        maxMemory = size;
+    }
+
+    // Readable when some pipe has output to drain, -1 until a job was captured
+    int getFd() const {
+        return epollFd;
+    }
+
+    // Redirects scope to a new capture for the next background job, does nothing under CAPTURE_TTY.
+    // Returns false after logging why the job cannot be captured.
+    bool open(CaptureScope *scope, JobOutput *output);
+
+    // Keeps what open prepared as the log of jobId, replacing the log of an earlier job with that id
+    void attach(int jobId, JobOutput *output);
+
+    // Drops what open prepared for a job that failed to start
+    void discard(JobOutput *output);
+
+    // Reads whatever the pipes hold now, without blocking
+    void drain();
+
+    // Returns nullptr when jobId has no log
+    const JobOutput *getOutput(int jobId) const;
+
+    // Writes the kept tail of the job's output to stdout, returns false when jobId has no log
+    bool printTail(int jobId);
+};
+
+#endif //SMASH_JOBOUTPUT_H_
@@ -0,0 +1,340 @@
+#include "parser.h"
+#include "utils.h"
+
+using namespace std;
+
+enum TokenType {
+    TOKEN_WORD,
+    TOKEN_SEMICOLON,
+    TOKEN_BACKGROUND,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_PIPE,
+    TOKEN_PIPE_ALL,
+    TOKEN_REDIRECTION,
+    TOKEN_END
+};
+
+struct Token {
+    TokenType type;
+    RedirectionType redirection;
+    // The token's text is line[begin, end)
+    size_t begin;
+    size_t end;
+};
+
+static bool isOperatorChar(char c) {
+    return c == ';' || c == '&' || c == '|' || c == '<' || c == '>';
+}
+
+static bool startsWith(const string &line, size_t i, const char *prefix) {
+    return line.compare(i, strlen(prefix), prefix) == 0;
+}
+
+// Returns the length of the operator at line[i] and fills in token, or 0 when a word starts there
+static size_t lexOperator(const string &line, size_t i, Token *token) {
+    struct Operator {
+        const char *text;
+        TokenType type;
+        RedirectionType redirection;
+    };
+    // Longest first, so && is never read as two &
+    static const Operator operators[] = {{"2>&1", TOKEN_REDIRECTION, REDIRECT_ERR_TO_OUT},
+                                         {"&>>",  TOKEN_REDIRECTION, REDIRECT_ALL_APPEND},
+                                         {"2>>",  TOKEN_REDIRECTION, REDIRECT_ERR_APPEND},
+                                         {"&&",   TOKEN_AND,         REDIRECT_IN},
+                                         {"||",   TOKEN_OR,          REDIRECT_IN},
+                                         {"|&",   TOKEN_PIPE_ALL,    REDIRECT_IN},
+                                         {"&>",   TOKEN_REDIRECTION, REDIRECT_ALL},
+                                         {">>",   TOKEN_REDIRECTION, REDIRECT_APPEND},
+                                         {"2>",   TOKEN_REDIRECTION, REDIRECT_ERR},
+                                         {";",    TOKEN_SEMICOLON,   REDIRECT_IN},
+                                         {"&",    TOKEN_BACKGROUND,  REDIRECT_IN},
+                                         {"|",    TOKEN_PIPE,        REDIRECT_IN},
+                                         {"<",    TOKEN_REDIRECTION, REDIRECT_IN},
+                                         {">",    TOKEN_REDIRECTION, REDIRECT_OUT}};
+
+    // A 2 only starts an operator at the beginning of a word, a2>f writes a2 to f
+    if (!isOperatorChar(line[i]) && line[i] != '2') {
+        return 0;
+    }
+    for (auto &op : operators) {
+        if (startsWith(line, i, op.text)) {
+            token->type = op.type;
+            token->redirection = op.redirection;
+            token->begin = i;
+            token->end = i + strlen(op.text);
+            return token->end - i;
+        }
+    }
+    return 0;
+}
+
+// Splits line into words and operators. Quotes and escapes stay in the words, they only decide where a
+// word ends. Returns false on an unterminated quote.
+static bool lexLine(const string &line, vector<Token> *tokens, string *error) {
+    size_t i = 0;
+    while (true) {
+        while (i < line.size() && _isWhitespace(line[i])) {
+            i++;
+        }
+        // An unquoted # at the start of a word comments out the rest of the line
+        if (i == line.size() || line[i] == '#') {
+            break;
+        }
+
+        Token token;
+        if (lexOperator(line, i, &token) > 0) {
+            tokens->push_back(token);
+            i = token.end;
+            continue;
+        }
+
+        token.type = TOKEN_WORD;
+        token.begin = i;
+        char quote = 0;
+        for (; i < line.size(); i++) {
+            auto c = line[i];
+            if (quote != 0) {
+                if (c == quote) {
+                    quote = 0;
+                } else if (quote == '"' && c == '\\') {
+                    i++;
+                }
+            } else if (_isWhitespace(c) || isOperatorChar(c)) {
+                break;
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+            } else if (c == '\\') {
+                i++;
+            }
+        }
+        if (quote != 0) {
+            *error = string("unexpected EOF while looking for matching `") + quote + "'";
+            return false;
+        }
+        token.end = min(i, line.size());
+        tokens->push_back(token);
+    }
+
+    Token end;
+    end.type = TOKEN_END;
+    end.begin = end.end = line.size();
+    tokens->push_back(end);
+    return true;
+}
+
+// Words that open a compound command when they start one, smash leaves their grammar to bash
+static bool isCompoundKeyword(const string &word) {
+    static const char *const keywords[] = {"for", "while", "until", "if", "case", "select", "function", "{", "[["};
+    for (auto keyword : keywords) {
+        if (word == keyword) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isCommandStart(const vector<Token> &tokens, size_t i) {
+    return i == 0 || (tokens[i - 1].type != TOKEN_WORD && tokens[i - 1].type != TOKEN_REDIRECTION);
+}
+
+// True when line uses bash grammar beyond what the parser knows: command substitutions, subshells, compound
+// commands, here-documents and fd duplications other than 2>&1. Splitting such a line on its operators would
+// tear it apart, so it runs whole under bash -c as every line did before smash had a parser.
+static bool needsBash(const string &line, const vector<Token> *tokens) {
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+        auto c = line[i];
+        auto next = i + 1 < line.size() ? line[i + 1] : '\0';
+        if (quote == '\'') {
+            quote = c == quote ? 0 : quote;
+            continue;
+        }
+        if (c == '\\') {
+            i++;
+        } else if (c == '`' || (c == '$' && next == '(')) {
+            return true;
+        } else if (quote == '"') {
+            quote = c == quote ? 0 : quote;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '#' && (i == 0 || _isWhitespace(line[i - 1]))) {
+            break;
+        } else if (c == '(' || c == ')' || (c == '<' && (next == '<' || next == '&' || next == '>')) ||
+                   (c == '>' && next == '&' && !(i > 0 && line[i - 1] == '2' && startsWith(line, i, ">&1")))) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; tokens != nullptr && i < tokens->size(); i++) {
+        auto &token = (*tokens)[i];
+        if (token.type == TOKEN_WORD && isCommandStart(*tokens, i) &&
+            isCompoundKeyword(line.substr(token.begin, token.end - token.begin))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The whole line as a single command, only a trailing & is still taken as running it in the background
+static void parseWholeLine(const string &line, const vector<Token> *tokens, ListNode *list) {
+    auto isBackground = tokens != nullptr && tokens->size() >= 2 &&
+                        (*tokens)[tokens->size() - 2].type == TOKEN_BACKGROUND;
+    auto end = isBackground ? (*tokens)[tokens->size() - 2].begin : line.size();
+
+    SimpleCommandNode command;
+    command.text = _trim(line.substr(0, end));
+    PipelineNode pipeline;
+    pipeline.text = command.text;
+    pipeline.stages.push_back(command);
+    pipeline.pipeStdErr.push_back(false);
+    AndOrNode andOr;
+    andOr.text = command.text;
+    andOr.pipelines.push_back(pipeline);
+    list->items.push_back(andOr);
+    list->isBackground.push_back(isBackground);
+}
+
+class Parser {
+    const string &line;
+    const vector<Token> &tokens;
+    size_t pos;
+    string *error;
+
+    const Token &peek() const {
+        return tokens[pos];
+    }
+
+    string text(size_t firstToken, size_t lastToken) const {
+        return line.substr(tokens[firstToken].begin, tokens[lastToken].end - tokens[firstToken].begin);
+    }
+
+    bool unexpected() const {
+        auto &token = peek();
+        *error = "syntax error near unexpected token `" +
+                 (token.type == TOKEN_END ? string("newline") : text(pos, pos)) + "'";
+        return false;
+    }
+
+    bool parseSimpleCommand(SimpleCommandNode *command) {
+        auto first = pos;
+
+        while (true) {
+            auto &token = peek();
+            if (token.type == TOKEN_WORD) {
+                if (!command->text.empty()) {
+                    command->text += ' ';
+                }
+                command->text += text(pos, pos);
+                pos++;
+            } else if (token.type == TOKEN_REDIRECTION) {
+                pos++;
+                Redirection redirection = {token.redirection, ""};
+                if (token.redirection != REDIRECT_ERR_TO_OUT) {
+                    if (peek().type != TOKEN_WORD) {
+                        return unexpected();
+                    }
+                    Tokenizer tokenizer;
+                    tokenizer.tokenize(line.data() + peek().begin, peek().end - peek().begin);
+                    redirection.path = tokenizer[0].str();
+                    pos++;
+                }
+                command->redirections.push_back(redirection);
+            } else {
+                break;
+            }
+        }
+        return pos > first || unexpected();
+    }
+
+    bool parsePipeline(PipelineNode *pipeline) {
+        auto first = pos;
+        while (true) {
+            pipeline->stages.emplace_back();
+            if (!parseSimpleCommand(&pipeline->stages.back())) {
+                return false;
+            }
+            auto type = peek().type;
+            if (type != TOKEN_PIPE && type != TOKEN_PIPE_ALL) {
+                pipeline->pipeStdErr.push_back(false);
+                break;
+            }
+            pipeline->pipeStdErr.push_back(type == TOKEN_PIPE_ALL);
+            pos++;
+        }
+        pipeline->text = text(first, pos - 1);
+        return true;
+    }
+
+    bool parseAndOr(AndOrNode *andOr) {
+        auto first = pos;
+        while (true) {
+            andOr->pipelines.emplace_back();
+            if (!parsePipeline(&andOr->pipelines.back())) {
+                return false;
+            }
+            auto type = peek().type;
+            if (type != TOKEN_AND && type != TOKEN_OR) {
+                break;
+            }
+            andOr->isOr.push_back(type == TOKEN_OR);
+            pos++;
+        }
+        andOr->text = text(first, pos - 1);
+        return true;
+    }
+
+public:
+    Parser(const string &line, const vector<Token> &tokens, string *error) : line(line), tokens(tokens), pos(0),
+                                                                             error(error) {}
+
+    bool parseList(ListNode *list) {
+        while (peek().type != TOKEN_END) {
+            list->items.emplace_back();
+            if (!parseAndOr(&list->items.back())) {
+                return false;
+            }
+            auto type = peek().type;
+            if (type == TOKEN_SEMICOLON || type == TOKEN_BACKGROUND) {
+                pos++;
+            } else if (type != TOKEN_END) {
+                return unexpected();
+            }
+            list->isBackground.push_back(type == TOKEN_BACKGROUND);
+        }
+        return true;
+    }
+};
+
+bool parseCommandLine(const string &line, ListNode *list, string *error) {
+    vector<Token> tokens;
+    string lexError;
+    auto isLexed = lexLine(line, &tokens, &lexError);
+    if (needsBash(line, isLexed ? &tokens : nullptr)) {
+        parseWholeLine(line, isLexed ? &tokens : nullptr, list);
+        return true;
+    }
+    if (!isLexed) {
+        *error = lexError;
+        return false;
+    }
+    return Parser(line, tokens, error).parseList(list);
+}
+
+ParsedLine parseLine(const string &line) {
+    ParsedLine parsed;
+    auto list = make_shared<ListNode>();
+    if (parseCommandLine(line, list.get(), &parsed.error)) {
+        parsed.list = list;
+    }
+    return parsed;
+}
+
+const ParsedLine &ParseCache::parse(const string &line) {
+    auto it = lines.find(line);
+    if (it == lines.end()) {
+        it = lines.emplace(line, parseLine(line)).first;
+    }
+    return it->second;
+}
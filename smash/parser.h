@@ -0,0 +1,78 @@
+#ifndef SMASH_PARSER_H_
+#define SMASH_PARSER_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum RedirectionType {
+    REDIRECT_IN,         // <
+    REDIRECT_OUT,        // >
+    REDIRECT_APPEND,     // >>
+    REDIRECT_ERR,        // 2>
+    REDIRECT_ERR_APPEND, // 2>>
+    REDIRECT_ALL,        // &>
+    REDIRECT_ALL_APPEND, // &>>
+    REDIRECT_ERR_TO_OUT  // 2>&1, has no path
+};
+
+struct Redirection {
+    RedirectionType type;
+    std::string path;
+};
+
+// The words of a command as they were typed (still quoted) joined by spaces, so createSimpleCommand can
+// tokenize them like any other command line. Redirections are applied in order.
+struct SimpleCommandNode {
+    std::string text;
+    std::vector<Redirection> redirections;
+};
+
+struct PipelineNode {
+    std::string text;
+    std::vector<SimpleCommandNode> stages;
+    // pipeStdErr[i] is set when stage i is followed by |& and its stderr goes to the pipe as well
+    std::vector<bool> pipeStdErr;
+};
+
+// Pipelines joined by && and ||, isOr[i] is the operator between pipelines i and i + 1
+struct AndOrNode {
+    std::string text;
+    std::vector<PipelineNode> pipelines;
+    std::vector<bool> isOr;
+};
+
+// A whole command line: and-or lists separated by ; or &
+struct ListNode {
+    std::vector<AndOrNode> items;
+    std::vector<bool> isBackground;
+};
+
+// Parses line into list following the bash grammar for ; & && || | |& and redirections, quoting is left to
+// the tokenizer. A line using grammar beyond that (substitutions, subshells, compound commands) comes back as one
+// command holding the whole line. Returns false with the syntax error in error.
+bool parseCommandLine(const std::string &line, ListNode *list, std::string *error);
+
+// A parsed line: the tree, or the syntax error to report whenever the line runs
+struct ParsedLine {
+    std::shared_ptr<const ListNode> list;
+    std::string error;
+};
+
+ParsedLine parseLine(const std::string &line);
+
+// Parsed lines by content, so a script that repeats a line is lexed and parsed only once
+class ParseCache {
+    std::unordered_map<std::string, ParsedLine> lines;
+
+public:
+    // The returned reference stays valid as long as the cache
+    const ParsedLine &parse(const std::string &line);
+
+    size_t size() const {
+        return lines.size();
+    }
+};
+
+#endif //SMASH_PARSER_H_
@@ -0,0 +1,184 @@
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "placement.h"
+#include "utils.h"
+
+using namespace std;
+
+#define NODE_BITS (8 * sizeof(unsigned long))
+
+bool parseIdList(const string &list, vector<int> *ids) {
+    ids->clear();
+    auto at = list.c_str();
+    while (*at != '\0') {
+        char *end;
+        errno = 0;
+        auto first = strtol(at, &end, 10);
+        auto last = first;
+        if (end == at || errno != 0 || first < 0) {
+            return false;
+        }
+        if (*end == '-') {
+            at = end + 1;
+            last = strtol(at, &end, 10);
+            if (end == at || errno != 0 || last < first) {
+                return false;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (auto id = first; id <= last; id++) {
+            ids->push_back((int) id);
+        }
+
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return false;
+        }
+        at = end;
+    }
+    return !ids->empty();
+}
+
+bool setPlacementCpus(const vector<int> &cpus, Placement *placement) {
+    CPU_ZERO(&placement->cpus);
+    for (auto cpu : cpus) {
+        if (cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        CPU_SET(cpu, &placement->cpus);
+    }
+    placement->hasCpus = true;
+    return true;
+}
+
+bool setPlacementNodes(const vector<int> &nodes, int memoryMode, Placement *placement) {
+    placement->nodes.assign(PLACEMENT_NODE_WORDS, 0);
+    for (auto node : nodes) {
+        if (node >= PLACEMENT_MAX_NODES) {
+            return false;
+        }
+        placement->nodes[node / NODE_BITS] |= 1UL << (node % NODE_BITS);
+    }
+    placement->memoryMode = memoryMode;
+    return true;
+}
+
+// The kernel reads maxnode - 1 bits of the mask
+static long setMemoryPolicy(int mode, const vector<unsigned long> &nodes) {
+    return syscall(SYS_set_mempolicy, mode, mode == MPOL_DEFAULT ? nullptr : nodes.data(),
+                   mode == MPOL_DEFAULT ? 0 : PLACEMENT_MAX_NODES + 1);
+}
+
+bool PlacementScope::apply(const Placement &placement) {
+    if (placement.hasCpus) {
+        if (sched_getaffinity(0, sizeof(savedCpus), &savedCpus) == -1) {
+            logSysCallError("sched_getaffinity");
+            return false;
+        }
+        if (sched_setaffinity(0, sizeof(placement.cpus), &placement.cpus) == -1) {
+            logSysCallError("sched_setaffinity");
+            return false;
+        }
+        isCpusSet = true;
+    }
+
+    if (placement.memoryMode != 0) {
+        if (syscall(SYS_get_mempolicy, &savedMode, savedNodes.data(), PLACEMENT_MAX_NODES, nullptr, 0) == -1) {
+            logSysCallError("get_mempolicy");
+            return false;
+        }
+        if (setMemoryPolicy(placement.memoryMode, placement.nodes) == -1) {
+            logSysCallError("set_mempolicy");
+            return false;
+        }
+        isMemorySet = true;
+    }
+    return true;
+}
+
+PlacementScope::~PlacementScope() {
+    if (isCpusSet && sched_setaffinity(0, sizeof(savedCpus), &savedCpus) == -1) {
+        logSysCallError("sched_setaffinity");
+    }
+    if (isMemorySet && setMemoryPolicy(savedMode, savedNodes) == -1) {
+        logSysCallError("set_mempolicy");
+    }
+}
+
+// Reads a sysfs list file such as /sys/devices/system/node/has_cpu
+static bool readIdList(const string &path, vector<int> *ids) {
+    ifstream file(path);
+    string list;
+    return getline(file, list) && parseIdList(list, ids);
+}
+
+bool JobPlacer::setPolicy(PinPolicy newPolicy) {
+    targets.clear();
+    nodeCpus.clear();
+    next = 0;
+    policy = PIN_OFF;
+    if (newPolicy == PIN_OFF) {
+        return true;
+    }
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        logSysCallError("sched_getaffinity");
+        return false;
+    }
+
+    if (newPolicy == PIN_CORES) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                targets.push_back(cpu);
+            }
+        }
+    } else {
+        vector<int> nodes, cpus;
+        if (!readIdList("/sys/devices/system/node/has_cpu", &nodes)) {
+            logError("set: pin=nodes needs NUMA support");
+            return false;
+        }
+        for (auto node : nodes) {
+            cpu_set_t nodeSet;
+            CPU_ZERO(&nodeSet);
+            if (readIdList("/sys/devices/system/node/node" + to_string(node) + "/cpulist", &cpus)) {
+                for (auto cpu : cpus) {
+                    if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                        CPU_SET(cpu, &nodeSet);
+                    }
+                }
+            }
+            if (CPU_COUNT(&nodeSet) > 0) {
+                targets.push_back(node);
+                nodeCpus.push_back(nodeSet);
+            }
+        }
+    }
+
+    policy = targets.empty() ? PIN_OFF : newPolicy;
+    return !targets.empty();
+}
+
+bool JobPlacer::nextPlacement(Placement *placement) {
+    if (policy == PIN_OFF) {
+        return false;
+    }
+
+    auto i = next++ % targets.size();
+    if (policy == PIN_CORES) {
+        setPlacementCpus(vector<int>(1, targets[i]), placement);
+    } else {
+        // Preferred rather than bound, a job outgrowing its node spills over instead of being killed
+        placement->cpus = nodeCpus[i];
+        placement->hasCpus = true;
+        setPlacementNodes(vector<int>(1, targets[i]), MPOL_PREFERRED, placement);
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef SMASH_PLACEMENT_H_
+#define SMASH_PLACEMENT_H_
+
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <string>
+#include <vector>
+
+// Node masks passed to the mempolicy syscalls, in bits
+#define PLACEMENT_MAX_NODES (1024)
+#define PLACEMENT_NODE_WORDS (PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long)))
+
+enum PinPolicy {
+    PIN_OFF,   // background jobs run wherever smash may run
+    PIN_CORES, // each background job on the next CPU smash may run on
+    PIN_NODES  // each background job on the CPUs of the next NUMA node, preferring its memory
+};
+
+// The CPUs a job may run on and the NUMA nodes its memory comes from, either may be left unset
+struct Placement {
+    cpu_set_t cpus;
+    bool hasCpus;
+    // MPOL_BIND or MPOL_PREFERRED, 0 leaves the memory policy alone
+    int memoryMode;
+    std::vector<unsigned long> nodes;
+
+    Placement() : cpus(), hasCpus(false), memoryMode(0), nodes(PLACEMENT_NODE_WORDS, 0) {
+        CPU_ZERO(&cpus);
+    }
+};
+
+// Parses a list such as "0-3,6" as taskset -c and numactl take it, returns false if invalid
+bool parseIdList(const std::string &list, std::vector<int> *ids);
+
+bool setPlacementCpus(const std::vector<int> &cpus, Placement *placement);
+
+bool setPlacementNodes(const std::vector<int> &nodes, int memoryMode, Placement *placement);
+
+// Applies a placement to smash itself until it goes out of scope. Whatever smash creates meanwhile (posix_spawn,
+// fork, clone3) inherits the CPU affinity and memory policy, so jobs are placed without a wrapper process and
+// posix_spawn keeps its fast path, having no attribute for either.
+class PlacementScope {
+    cpu_set_t savedCpus;
+    bool isCpusSet;
+    int savedMode;
+    std::vector<unsigned long> savedNodes;
+    bool isMemorySet;
+public:
+    PlacementScope() : savedCpus(), isCpusSet(false), savedMode(0), savedNodes(PLACEMENT_NODE_WORDS, 0),
+                       isMemorySet(false) {}
+
+    ~PlacementScope();
+
+    PlacementScope(PlacementScope const &) = delete;
+
+    void operator=(PlacementScope const &) = delete;
+
+    // Returns false after logging the failed syscall, leaving smash as it was
+    bool apply(const Placement &placement);
+};
+
+// Hands out the placement of each background job under set pin=cores|nodes
+class JobPlacer {
+    PinPolicy policy;
+    // CPUs or nodes, in the order jobs get them
+    std::vector<int> targets;
+    std::vector<cpu_set_t> nodeCpus;
+    size_t next;
+public:
+    JobPlacer() : policy(PIN_OFF), targets(), nodeCpus(), next(0) {}
+
+    // Takes the CPUs smash may run on (or the nodes having some of them) as of now
+    bool setPolicy(PinPolicy newPolicy);
+
+    PinPolicy getPolicy() const {
+        return policy;
+    }
+
+    // Returns false when the policy is off
+    bool nextPlacement(Placement *placement);
+};
+
+#endif //SMASH_PLACEMENT_H_
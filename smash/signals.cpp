@@ -1,55 +1,335 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include "commands.h"
+#include "signals.h"
 
 using namespace std;
 
+static int signalPipe[2] = {-1, -1};
+static int childEventsFd = -1;
+
+// The only work done in signal context: queue the signal number for dispatchSignals
+static void queueSignal(int sig_num) {
+    auto savedErrno = errno;
+    auto sig = (unsigned char) sig_num;
+    if (write(signalPipe[1], &sig, 1) == -1) {
+        // The pipe is full, plenty of identical signals are already queued
+    }
+    errno = savedErrno;
+}
+
 void ctrlCHandler(int sig_num) {
     cout << "smash: got ctrl-C" << endl;
-    auto fg = SmallShell::fgProcess;
+    auto fg = SmallShell::fgProcess.get();
 
     // Don't do anything if no fg process
-    if (fg->pid == -1) {
+    if (fg == nullptr || fg->pid == -1 || fg->isFinished) {
         return;
     }
 
-    auto killRes = kill(fg->pid, SIGKILL);
+    auto killRes = kill(-fg->pid, SIGKILL);
 
     if (killRes == -1) {
         logSysCallError("kill");
     } else {
+        // The entry stays in the fg slot until waitForeground has reaped every process of the job
         cout << "smash: process " << fg->pid << " was killed" << endl;
-
-        auto jobsList = SmallShell::jobsList;
-        jobsList->removeJobByPid(fg->pid);
-        delete SmallShell::fgProcess;
-        SmallShell::fgProcess = nullptr;
     }
 }
 
 void ctrlZHandler(int sig_num) {
     cout << "smash: got ctrl-Z" << endl;
-    auto fg = SmallShell::fgProcess;
+    auto fg = SmallShell::fgProcess.get();
 
     // Don't do anything if no fg process
-    if (fg == nullptr || fg->pid == -1) {
+    if (fg == nullptr || fg->pid == -1 || fg->isFinished) {
         return;
     }
 
-    auto killRes = kill(fg->pid, SIGSTOP);
+    auto killRes = kill(-fg->pid, SIGSTOP);
 
     if (killRes == -1) {
         logSysCallError("kill");
     } else {
         auto jobsList = SmallShell::jobsList;
-        fg->endTime = getCurrentTime();
+        fg->endTime = getMonotonicTime();
         fg->isStopped = true;
 
-        jobsList->addJob(fg);
+        jobsList->addJob(std::move(SmallShell::fgProcess));
 
         cout << "smash: process " << fg->pid << " was stopped" << endl;
-        SmallShell::fgProcess = nullptr;
     }
 
 }
+
+bool setupSignalHandlers() {
+    if (pipe2(signalPipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        logSysCallError("pipe");
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = queueSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    auto isSet = true;
+    if (sigaction(SIGTSTP, &action, nullptr) == -1) {
+        perror("smash error: failed to set ctrl-Z handler");
+        isSet = false;
+    }
+    if (sigaction(SIGINT, &action, nullptr) == -1) {
+        perror("smash error: failed to set ctrl-C handler");
+        isSet = false;
+    }
+    return isSet;
+}
+
+int getSignalPipeFd() {
+    return signalPipe[0];
+}
+
+bool dispatchSignals() {
+    unsigned char sigs[64];
+    ssize_t readCount;
+    auto isInterrupted = false;
+    while ((readCount = read(signalPipe[0], sigs, sizeof(sigs))) > 0) {
+        for (ssize_t i = 0; i < readCount; i++) {
+            if (sigs[i] == SIGINT) {
+                ctrlCHandler(sigs[i]);
+                isInterrupted = true;
+            } else if (sigs[i] == SIGTSTP) {
+                ctrlZHandler(sigs[i]);
+            }
+        }
+    }
+    return isInterrupted;
+}
+
+void resetSignalsAfterFork() {
+    sigset_t emptyMask;
+    sigemptyset(&emptyMask);
+    sigprocmask(SIG_SETMASK, &emptyMask, nullptr);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    close(signalPipe[0]);
+    close(signalPipe[1]);
+    close(childEventsFd);
+    signalPipe[0] = signalPipe[1] = childEventsFd = -1;
+}
+
+int waitForeground(JobEntry *job) {
+    PhaseTimer timer(&TimePhases::waitNs);
+    int wstatus = 0;
+    struct rusage usage;
+
+    while (job->livePids > 0) {
+        // A forked background smash has no other children, and its own ones do not lead process groups
+        auto waitId = SmallShell::isSubshell ? -1 : -job->pid;
+        auto waitRes = wait4(waitId, &wstatus, WUNTRACED | (childEventsFd == -1 ? 0 : WNOHANG), &usage);
+        if (waitRes > 0) {
+            if (WIFSTOPPED(wstatus)) {
+                return wstatus;
+            }
+            job->reap(waitRes, wstatus, usage);
+            continue;
+        } else if (waitRes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nothing of the process group is left to wait for
+            job->livePids = 0;
+            break;
+        }
+
+        // Captured background jobs keep writing meanwhile, their pipes must not fill up
+        struct pollfd fds[] = {{signalPipe[0], POLLIN, 0},
+                               {childEventsFd, POLLIN, 0},
+                               {SmallShell::jobOutputs->getFd(), POLLIN, 0}};
+        if (poll(fds, 3, -1) == -1) {
+            if (errno != EINTR) {
+                logSysCallError("poll");
+                return -1;
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            dispatchSignals();
+        }
+
+        if (fds[2].revents & POLLIN) {
+            SmallShell::jobOutputs->drain();
+        }
+
+        // Background jobs that finished meanwhile are reaped after the foreground command returns
+        struct signalfd_siginfo info;
+        while (read(childEventsFd, &info, sizeof(info)) == sizeof(info)) {
+        }
+    }
+
+    job->isFinished = true;
+    job->endTime = getMonotonicTime();
+    return job->exitStatus;
+}
+
+// Returns a pidfd that becomes readable when pid exits, or -1 when the kernel has none
+static int openPidFd(pid_t pid) {
+#if defined(SYS_pidfd_open)
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static bool isWaitOver(const vector<JobEntry *> &jobs, bool isAny, JobEntry **first) {
+    *first = nullptr;
+    auto finishedCount = 0;
+    for (auto job : jobs) {
+        if (job->isFinished) {
+            finishedCount++;
+            if (*first == nullptr || job->endTime < (*first)->endTime) {
+                *first = job;
+            }
+        }
+    }
+    // Nothing to wait for is over at once, whatever the mode
+    return isAny ? finishedCount > 0 || jobs.empty() : finishedCount == (int) jobs.size();
+}
+
+WaitResult waitForJobs(const vector<JobEntry *> &jobs, bool isAny, int timeoutMs, JobEntry **first) {
+    *first = nullptr;
+    if (childEventsFd == -1) {
+        return jobs.empty() ? WAIT_DONE : WAIT_NO_CHILDREN;
+    }
+
+    SmallShell::jobsList->reapChildren();
+    if (isWaitOver(jobs, isAny, first)) {
+        return WAIT_DONE;
+    }
+
+    auto epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        logSysCallError("epoll_create1");
+        return WAIT_DONE;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = signalPipe[0];
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalPipe[0], &event);
+    if (SmallShell::jobOutputs->getFd() != -1) {
+        event.data.fd = SmallShell::jobOutputs->getFd();
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, event.data.fd, &event);
+    }
+
+    // Only the waited processes wake the wait, unlike SIGCHLD, which every child raises. Kernels without
+    // pidfds fall back to the signalfd.
+    vector<int> pidFds;
+    auto isFallback = false;
+    for (auto job : jobs) {
+        for (size_t i = 0; i < job->pids.size() && !isFallback; i++) {
+            auto pidFd = job->isReaped[i] ? -1 : openPidFd(job->pids[i]);
+            if (pidFd != -1) {
+                pidFds.push_back(pidFd);
+                event.data.fd = pidFd;
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, pidFd, &event);
+            } else if (!job->isReaped[i] && errno != ESRCH) {
+                isFallback = true;
+            }
+        }
+    }
+    if (isFallback) {
+        event.data.fd = childEventsFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, childEventsFd, &event);
+    }
+
+    auto deadline = timeoutMs < 0 ? 0 : getMonotonicTime() + (int64_t) timeoutMs * 1000000;
+    auto result = WAIT_DONE;
+    struct epoll_event events[8];
+    while (!isWaitOver(jobs, isAny, first)) {
+        auto waitMs = -1;
+        if (timeoutMs >= 0) {
+            auto remainingNs = deadline - getMonotonicTime();
+            if (remainingNs <= 0) {
+                result = WAIT_TIMEOUT;
+                break;
+            }
+            waitMs = (int) ((remainingNs + 999999) / 1000000);
+        }
+
+        auto eventsCount = epoll_wait(epollFd, events, 8, waitMs);
+        if (eventsCount == -1) {
+            if (errno != EINTR) {
+                logSysCallError("epoll_wait");
+                break;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < eventsCount; i++) {
+            auto fd = events[i].data.fd;
+            if (fd == signalPipe[0]) {
+                if (dispatchSignals()) {
+                    result = WAIT_INTERRUPTED;
+                }
+            } else if (fd == SmallShell::jobOutputs->getFd()) {
+                SmallShell::jobOutputs->drain();
+            } else if (fd == childEventsFd) {
+                struct signalfd_siginfo info;
+                while (read(childEventsFd, &info, sizeof(info)) == sizeof(info)) {
+                }
+            } else {
+                // An exited process keeps its pidfd readable
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+        }
+        if (result == WAIT_INTERRUPTED) {
+            break;
+        }
+        SmallShell::jobsList->reapChildren();
+    }
+
+    for (auto pidFd : pidFds) {
+        close(pidFd);
+    }
+    close(epollFd);
+    return result;
+}
+
+int setupChildEvents() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1) {
+        logSysCallError("sigprocmask");
+        return -1;
+    }
+
+    childEventsFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (childEventsFd == -1) {
+        logSysCallError("signalfd");
+    }
+    return childEventsFd;
+}
+
+void handleChildEvents(int childEventsFd) {
+    // Several SIGCHLDs may coalesce into one siginfo, so the siginfo only tells that waitpid has work
+    struct signalfd_siginfo info;
+    while (read(childEventsFd, &info, sizeof(info)) == sizeof(info)) {
+    }
+
+    SmallShell::jobsList->removeFinishedJobs();
+}
@@ -1,8 +1,49 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 
+#include <sys/types.h>
+#include <vector>
+
+struct JobEntry;
+
+// Ctrl-C/Ctrl-Z handling, run from dispatchSignals in the main loop and never in signal context
 void ctrlCHandler(int sig_num);
 
 void ctrlZHandler(int sig_num);
 
+// Installs SIGINT/SIGTSTP handlers that only write the signal number to a self-pipe
+bool setupSignalHandlers();
+
+// Read end of the self-pipe, readable when signals are waiting for dispatchSignals
+int getSignalPipeFd();
+
+// Returns true when a Ctrl-C was among the signals
+bool dispatchSignals();
+
+// Forked smash children run in their own process group and wait for their children plainly
+void resetSignalsAfterFork();
+
+// Waits until every process of the job exits or one of them stops while dispatching Ctrl-C/Ctrl-Z.
+// Returns the wait status of the job's last process, or the stop status, or -1.
+int waitForeground(JobEntry *job);
+
+enum WaitResult {
+    WAIT_DONE,
+    WAIT_TIMEOUT,
+    WAIT_INTERRUPTED, // by Ctrl-C
+    WAIT_NO_CHILDREN  // in a forked smash, which has none of the jobs as children
+};
+
+// Waits until every one of the jobs is finished, or the first of them with isAny, for at most timeoutMs
+// (-1 waits as long as it takes). Sleeps in epoll_wait on the pidfds of the jobs' processes while dispatching
+// Ctrl-C/Ctrl-Z. first is set to the job that finished first, nullptr when none did.
+WaitResult waitForJobs(const std::vector<JobEntry *> &jobs, bool isAny, int timeoutMs, JobEntry **first);
+
+// Blocks SIGCHLD and returns a signalfd that becomes readable whenever a child changes state,
+// or -1 on failure
+int setupChildEvents();
+
+// Drains the SIGCHLD signalfd and updates the jobs list with every child that changed state
+void handleChildEvents(int childEventsFd);
+
 #endif //SMASH__SIGNALS_H_
@@ -1,22 +1,185 @@
 #include <iostream>
 #include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "commands.h"
 #include "signals.h"
 
+// Reads the next input line straight from fd 0 while dispatching Ctrl-C/Ctrl-Z, reaping finished jobs as soon
+// as their SIGCHLD arrives and draining captured job output, returns false on end of input
+static bool readLine(std::string &line, int childEventsFd) {
+    static std::string pending;
+    char buf[4096];
+
+    while (true) {
+        auto newline = pending.find('\n');
+        if (newline != std::string::npos) {
+            line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            return true;
+        }
+
+        struct pollfd fds[] = {{STDIN_FILENO, POLLIN, 0},
+                               {getSignalPipeFd(), POLLIN, 0},
+                               {childEventsFd, POLLIN, 0},
+                               {SmallShell::jobOutputs->getFd(), POLLIN, 0}};
+        if (poll(fds, 4, -1) == -1) {
+            if (errno != EINTR) {
+                logSysCallError("poll");
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            dispatchSignals();
+        }
+
+        if (fds[2].revents & POLLIN) {
+            handleChildEvents(childEventsFd);
+        }
+
+        // Under set notify=on jobs are reported as they finish, not at the next prompt
+        if (SmallShell::jobsList->hasNotices()) {
+            std::cout << std::endl;
+            SmallShell::jobsList->printNotices();
+            std::cout << "smash> " << std::flush;
+        }
+
+        if (fds[3].revents & POLLIN) {
+            SmallShell::jobOutputs->drain();
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            auto readCount = read(STDIN_FILENO, buf, sizeof(buf));
+            if (readCount > 0) {
+                pending.append(buf, readCount);
+            } else if (readCount == 0 || errno != EINTR) {
+                if (readCount == -1) {
+                    logSysCallError("read");
+                }
+                line.swap(pending);
+                pending.clear();
+                return !line.empty();
+            }
+        }
+    }
+}
+
+#define SCRIPT_READ_SIZE (1 << 20)
+
+typedef std::vector<std::pair<std::string, const ParsedLine *>> ScriptProgram;
+
+// Parses the whole script before any of it runs. Lines go through the parse cache, so a line that repeats
+// is parsed once and shares its tree.
+static void compileScript(const char *data, size_t size, ScriptProgram *program) {
+    auto end = data + size;
+    while (data < end) {
+        auto newline = (const char *) memchr(data, '\n', end - data);
+        auto lineEnd = newline == nullptr ? end : newline;
+        std::string line(data, lineEnd - data);
+
+        auto parsed = &SmallShell::parseCache->parse(line);
+        program->emplace_back(std::move(line), parsed);
+        data = lineEnd + 1;
+    }
+}
+
+static int runScript(const ScriptProgram &program) {
+    for (auto &line : program) {
+        SmallShell::executeCommand(line.first, *line.second);
+    }
+    return SmallShell::lastStatus;
+}
+
+// A regular file is mapped, anything else (a pipe, /dev/stdin) is read in large chunks
+static int runScriptFile(const char *path) {
+    auto fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        logSysCallError("open");
+        return 127;
+    }
+
+    ScriptProgram program;
+    struct stat st;
+    auto isMapped = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+    void *data = isMapped ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+
+    if (data != MAP_FAILED) {
+        compileScript((const char *) data, st.st_size, &program);
+        munmap(data, st.st_size);
+    } else {
+        std::string script;
+        ssize_t readCount;
+        do {
+            auto oldSize = script.size();
+            script.resize(oldSize + SCRIPT_READ_SIZE);
+            readCount = read(fd, &script[oldSize], SCRIPT_READ_SIZE);
+            script.resize(oldSize + std::max(readCount, (ssize_t) 0));
+        } while (readCount > 0 || (readCount == -1 && errno == EINTR));
+
+        if (readCount == -1) {
+            logSysCallError("read");
+            close(fd);
+            return 1;
+        }
+        compileScript(script.data(), script.size(), &program);
+    }
+    close(fd);
+
+    return runScript(program);
+}
+
 int main(int argc, char *argv[]) {
     SmallShell &smash = SmallShell::getInstance();
 
-    if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR) {
-        perror("smash error: failed to set ctrl-Z handler");
+    setupSignalHandlers();
+    auto childEventsFd = setupChildEvents();
+
+    // smash -f script / smash -c commands run without a prompt and exit with the last line's status
+    if (argc > 1) {
+        auto isFile = strcmp(argv[1], "-f") == 0;
+        if (argc != 3 || (!isFile && strcmp(argv[1], "-c") != 0)) {
+            logError("usage: smash [-f script | -c commands]");
+            return 2;
+        }
+
+        static ParseCache parseCache;
+        SmallShell::parseCache = &parseCache;
+
+        if (isFile) {
+            return runScriptFile(argv[2]);
+        }
+        ScriptProgram program;
+        compileScript(argv[2], strlen(argv[2]), &program);
+        return runScript(program);
     }
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
+
+    // Interactive shells keep their history in a file, SMASH_HISTFILE picks another path (an empty one turns
+    // it off) and keeps it for any input
+    auto historyPath = getenv("SMASH_HISTFILE");
+    auto home = getenv("HOME");
+    if (historyPath != nullptr ? historyPath[0] != '\0' : isatty(STDIN_FILENO) && home != nullptr) {
+        auto historySize = getenv("SMASH_HISTSIZE");
+        if (historySize != nullptr && toNumber(historySize) > 0) {
+            SmallShell::historySize = toNumber(historySize);
+        }
+
+        static HistoryFile historyFile;
+        auto path = historyPath != nullptr ? std::string(historyPath) : std::string(home) + "/" + HISTORY_FILE_NAME;
+        if (historyFile.open(path, SmallShell::historySize)) {
+            SmallShell::historyFile = &historyFile;
+        }
     }
 
     while (true) {
-        std::cout << "smash> ";
+        std::cout << "smash> " << std::flush;
         std::string cmd_line;
-        std::getline(std::cin, cmd_line);
+        if (!readLine(cmd_line, childEventsFd)) {
+            break;
+        }
         smash.executeCommand(cmd_line.c_str());
     }
 
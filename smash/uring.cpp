@@ -0,0 +1,121 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+IoUring::IoUring() : ringFd(-1), entries(0), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED),
+                     cqRingSize(0), sqes((struct io_uring_sqe *) MAP_FAILED), sqesSize(0), sqHead(nullptr),
+                     sqTail(nullptr), sqMask(nullptr), sqArray(nullptr), cqHead(nullptr), cqTail(nullptr),
+                     cqMask(nullptr), cqes(nullptr), queued(0) {}
+
+IoUring::~IoUring() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd != -1) {
+        close(ringFd);
+    }
+}
+
+bool IoUring::init(unsigned queueDepth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = (int) syscall(__NR_io_uring_setup, queueDepth, &params);
+    if (ringFd == -1) {
+        return false;
+    }
+    entries = params.sq_entries;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    auto isSingleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (isSingleMmap) {
+        sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                  IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        return false;
+    }
+    cqRing = isSingleMmap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          ringFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+        return false;
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                        ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+
+    auto sq = (char *) sqRing;
+    sqHead = (unsigned *) (sq + params.sq_off.head);
+    sqTail = (unsigned *) (sq + params.sq_off.tail);
+    sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *) (sq + params.sq_off.array);
+
+    auto cq = (char *) cqRing;
+    cqHead = (unsigned *) (cq + params.cq_off.head);
+    cqTail = (unsigned *) (cq + params.cq_off.tail);
+    cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return true;
+}
+
+bool IoUring::registerBuffers(const struct iovec *iovecs, unsigned count) {
+    return syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+}
+
+struct io_uring_sqe *IoUring::getSqe() {
+    auto head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    auto tail = *sqTail + queued;
+    if (tail - head >= entries) {
+        return nullptr;
+    }
+
+    auto index = tail & *sqMask;
+    auto sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    queued++;
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitCount) {
+    auto toSubmit = queued;
+    __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+    queued = 0;
+
+    while (true) {
+        auto res = syscall(__NR_io_uring_enter, ringFd, toSubmit, waitCount,
+                           waitCount > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        // The kernel reports EINTR only when nothing was submitted yet
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        return (int) res;
+    }
+}
+
+struct io_uring_cqe *IoUring::peekCqe() {
+    auto head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &cqes[head & *cqMask];
+}
+
+void IoUring::seenCqe() {
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
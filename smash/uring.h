@@ -0,0 +1,58 @@
+#ifndef SMASH_URING_H_
+#define SMASH_URING_H_
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+// Minimal io_uring wrapper over the raw syscalls, so smash does not depend on liburing.
+// Only what the copy engine needs: one submission queue, registered buffers and completion reaping.
+class IoUring {
+    int ringFd;
+    unsigned entries;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+    // Submission queue entries handed out by getSqe and not yet passed to the kernel
+    unsigned queued;
+
+public:
+    IoUring();
+
+    ~IoUring();
+
+    IoUring(IoUring const &) = delete;
+
+    void operator=(IoUring const &) = delete;
+
+    // Returns false (errno set) when the kernel has no io_uring or it is disabled
+    bool init(unsigned queueDepth);
+
+    bool registerBuffers(const struct iovec *iovecs, unsigned count);
+
+    // Returns a zeroed entry to fill in, or nullptr when the submission queue is full
+    struct io_uring_sqe *getSqe();
+
+    // Submits every queued entry and waits until at least waitCount completions are available
+    int submitAndWait(unsigned waitCount);
+
+    // Returns the oldest completion, or nullptr when there is none; release it with seenCqe
+    struct io_uring_cqe *peekCqe();
+
+    void seenCqe();
+};
+
+#endif //SMASH_URING_H_
@@ -2,9 +2,15 @@
 #define OS_HW1_WET_UTILS_H
 
 #include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
 #include <cstring>
 #include <sstream>
 #include <algorithm>
+#include <vector>
+#include <ctime>
+#include <cstdint>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -38,62 +44,160 @@ inline string _trim(const std::string &s) {
     return _rtrim(_ltrim(s));
 }
 
-inline int _parseCommandLine(const char *cmd_line, char **args) {
-    FUNC_ENTRY()
-    int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;) {
-        args[i] = (char *) malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
+inline bool _isWhitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+// A token of a tokenized line, pointing into the tokenizer's buffer (NUL terminated)
+struct StringView {
+    const char *data;
+    size_t size;
+
+    StringView() : data(""), size(0) {}
+
+    StringView(const char *data, size_t size) : data(data), size(size) {}
+
+    bool empty() const { return size == 0; }
+
+    char operator[](size_t i) const { return i < size ? data[i] : '\0'; }
+
+    bool operator==(const char *other) const { return strcmp(data, other) == 0; }
+
+    bool operator!=(const char *other) const { return !(*this == other); }
+
+    bool startsWith(const char *prefix) const { return strncmp(data, prefix, strlen(prefix)) == 0; }
+
+    string str() const { return string(data, size); }
+};
+
+// Splits a command line into words in a single pass, without allocating per word: quotes and escapes are
+// removed while copying the line into a buffer that is reused between lines, and every word is NUL terminated
+// in place so argv() can be handed to exec as is. Quoting follows bash: '...' is literal, in "..." a backslash
+// only escapes " \ $ ` and newline, an unquoted backslash escapes any character and # starts a comment.
+class Tokenizer {
+    vector<char> buffer;
+    // Always ends with nullptr, so the words double as an argv array
+    vector<char *> words;
+    vector<size_t> lengths;
+    bool isUnterminated;
+
+public:
+    Tokenizer() : buffer(), words(1, nullptr), lengths(), isUnterminated(false) {}
+
+    Tokenizer(Tokenizer const &) = delete;
+
+    void operator=(Tokenizer const &) = delete;
+
+    // Returns the number of words. Views from a previous call are invalidated.
+    size_t tokenize(const char *line, size_t length) {
+        // Every word is at least one character of the line followed by a separator, except the last one
+        buffer.resize(length + 1);
+        words.clear();
+        lengths.clear();
+        isUnterminated = false;
+
+        auto out = buffer.data();
+        size_t i = 0;
+        while (true) {
+            while (i < length && _isWhitespace(line[i])) {
+                i++;
+            }
+            // An unquoted # at the start of a word comments out the rest of the line
+            if (i == length || line[i] == '#') {
+                break;
+            }
+
+            auto start = out;
+            char quote = 0;
+            for (; i < length; i++) {
+                auto c = line[i];
+                if (quote == '\'') {
+                    if (c == '\'') {
+                        quote = 0;
+                    } else {
+                        *out++ = c;
+                    }
+                } else if (quote == '"') {
+                    auto next = i + 1 < length ? line[i + 1] : '\0';
+                    if (c == '"') {
+                        quote = 0;
+                    } else if (c == '\\' && next == '\n') {
+                        i++;
+                    } else if (c == '\\' && (next == '"' || next == '\\' || next == '$' || next == '`')) {
+                        *out++ = line[++i];
+                    } else {
+                        *out++ = c;
+                    }
+                } else if (_isWhitespace(c)) {
+                    break;
+                } else if (c == '\'' || c == '"') {
+                    quote = c;
+                } else if (c == '\\' && i + 1 < length) {
+                    // An escaped newline is a line continuation and disappears
+                    if (line[++i] != '\n') {
+                        *out++ = line[i];
+                    }
+                } else {
+                    *out++ = c;
+                }
+            }
+            if (quote != 0) {
+                isUnterminated = true;
+            }
+            words.push_back(start);
+            lengths.push_back(out - start);
+            *out++ = '\0';
+        }
+        words.push_back(nullptr);
+        return lengths.size();
     }
-    return i;
 
-    FUNC_EXIT()
-}
+    size_t tokenize(const string &line) {
+        return tokenize(line.data(), line.size());
+    }
 
-inline bool isBackgroundCommand(const char *cmd_line) {
-    const string whitespace = " \t\n";
-    const string str(cmd_line);
-    return str[str.find_last_not_of(whitespace)] == '&';
-}
+    size_t size() const {
+        return lengths.size();
+    }
 
+    // Out of range words are empty, like the unset entries of the old fixed argument array
+    StringView operator[](size_t i) const {
+        return i < lengths.size() ? StringView(words[i], lengths[i]) : StringView();
+    }
 
-inline bool isPipeCommand(const char *cmd_line) {
-    const string str(cmd_line);
-    if (str.find('|') == std::string::npos)
-        return false;
-    else
-        return str[str.find('|')] == '|';
-}
+    char **argv() {
+        return words.data();
+    }
 
-inline bool isRedirectionCommand(const char *cmd_line) {
-    const string str(cmd_line);
-    if (str.find('>') == std::string::npos)
-        return false;
-    else
-        return str[str.find('>')] == '>';
-}
+    bool hasUnterminatedQuote() const {
+        return isUnterminated;
+    }
+};
 
+const string SHELL_METACHARS = "|&;<>()$`*?[]#~{}!";
 
-inline void removeBackgroundSign(char *cmd_line) {
-    const string whitespace = " \t\n";
-    const string str(cmd_line);
-    // find last character other than spaces
-    size_t idx = str.find_last_not_of(whitespace);
-    // if all characters are spaces then return
-    if (idx == string::npos) {
-        return;
+// A line can skip /bin/bash when the tokenizer yields the same argv bash would: quoting is fine, but no
+// expansion, globbing or control operators and no leading assignment.
+inline bool canLaunchDirectly(const char *cmd_line, Tokenizer &tokenizer) {
+    if (strpbrk(cmd_line, SHELL_METACHARS.c_str()) != nullptr) {
+        return false;
     }
-    // if the command line does not end with & then return
-    if (cmd_line[idx] != '&') {
-        return;
+    auto words = tokenizer.tokenize(cmd_line, strlen(cmd_line));
+    return words > 0 && !tokenizer.hasUnterminatedQuote() && strchr(tokenizer[0].data, '=') == nullptr;
+}
+
+// Converts a waitpid status to the exit status a shell reports as $?, a failed wait (-1) counts as 1
+inline int exitStatusOf(int wstatus) {
+    if (wstatus == -1) {
+        return 1;
+    } else if (WIFEXITED(wstatus)) {
+        return WEXITSTATUS(wstatus);
+    } else if (WIFSIGNALED(wstatus)) {
+        return 128 + WTERMSIG(wstatus);
+    } else if (WIFSTOPPED(wstatus)) {
+        return 128 + WSTOPSIG(wstatus);
     }
-    // replace the & (background sign) with space and then remove all tailing spaces.
-    cmd_line[idx] = ' ';
-    // truncate the command line string up to the last non-space character
-    cmd_line[str.find_last_not_of(whitespace, idx - 1) + 1] = 0;
+    return 1;
 }
 
 inline void logSysCallError(const string &sys_call_name) {
@@ -101,17 +205,42 @@ inline void logSysCallError(const string &sys_call_name) {
     perror(message.c_str());
 }
 
+// Returns -1 when s is not a number or does not fit in an int, which every caller rejects as invalid
 inline int toNumber(const std::string &s) {
     int i;
     try {
         i = std::stoi(s);
     } catch (std::invalid_argument &) {
         return -1;
+    } catch (std::out_of_range &) {
+        return -1;
     }
 
     return i;
 }
 
+// Parses a byte count with an optional K/M/G suffix ("64K", "1M"), returns -1 if invalid
+inline long long parseSize(const std::string &s) {
+    char *end;
+    errno = 0;
+    auto size = strtoll(s.c_str(), &end, 10);
+    if (end == s.c_str() || errno != 0 || size < 0) {
+        return -1;
+    }
+
+    string suffix(end);
+    if (suffix.empty() || suffix == "B") {
+        return size;
+    } else if (suffix == "K" || suffix == "k") {
+        return size << 10;
+    } else if (suffix == "M" || suffix == "m") {
+        return size << 20;
+    } else if (suffix == "G" || suffix == "g") {
+        return size << 30;
+    }
+    return -1;
+}
+
 inline int parseSignalArg(const std::string &s) {
     string signalStr;
     signalStr.reserve(s.size());
@@ -123,6 +252,16 @@ inline void logError(const string &message) {
     cout << "smash error: " << message << endl;
 }
 
+// CLOCK_MONOTONIC in nanoseconds, job durations must not jump with the wall clock
+inline int64_t getMonotonicTime() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        logSysCallError("clock_gettime");
+        return 0;
+    }
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
 inline time_t getCurrentTime() {
     time_t currTime;
     auto timeRes = time(&currTime);